@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "aio_util.hpp"
+#include "mmap_util.hpp"
+#include "stats_util.hpp"
+
+namespace util {
+	// ring size, also caps the queue depth of a reader
+	static constexpr unsigned AIO_RING_ENTRIES = 64;
+	// threads serving reads when io_uring is unavailable
+	static constexpr size_t AIO_FALLBACK_THREADS = 8;
+
+
+	// minimal io_uring (no liburing), one per thread; completions carry their read_slot
+	class io_ring {
+	public:
+		io_ring() = default;
+		io_ring(const io_ring&) = delete;
+		~io_ring() {
+			if (sqe_addr != nullptr)
+				munmap(sqe_addr, sqe_size);
+			if (cq_addr != nullptr && cq_addr != sq_addr)
+				munmap(cq_addr, cq_size);
+			if (sq_addr != nullptr)
+				munmap(sq_addr, sq_size);
+			if (ring_fd != -1)
+				close(ring_fd);
+		}
+
+		io_ring& operator = (const io_ring&) = delete;
+
+		bool init() {
+			io_uring_params params = {};
+
+			if ((ring_fd = syscall(__NR_io_uring_setup, AIO_RING_ENTRIES, &params)) < 0)
+				return false;
+
+			sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+			cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			sqe_size = params.sq_entries * sizeof(io_uring_sqe);
+
+			// both rings share one mapping on all but the oldest kernels
+			if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+				sq_size = cq_size = std::max(sq_size, cq_size);
+
+			if ((sq_addr = map_ring(sq_size, IORING_OFF_SQ_RING)) == nullptr)
+				return false;
+			if ((cq_addr = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)? sq_addr: map_ring(cq_size, IORING_OFF_CQ_RING)) == nullptr)
+				return false;
+			if ((sqe_addr = map_ring(sqe_size, IORING_OFF_SQES)) == nullptr)
+				return false;
+
+			char* sq = static_cast<char*>(sq_addr);
+			char* cq = static_cast<char*>(cq_addr);
+
+			sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+			sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+			sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+			sqes = static_cast<io_uring_sqe*>(sqe_addr);
+
+			cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+			cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+			cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+			return true;
+		}
+
+		// returns false if the read could not be queued
+		bool submit(int fd, size_t offset, char* buffer, size_t size, uint64_t user_data) {
+			const uint32_t tail = *sq_tail;
+			const uint32_t index = tail & sq_mask;
+
+			io_uring_sqe& sqe = sqes[index];
+
+			sqe = {};
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = fd;
+			sqe.off = offset;
+			sqe.addr = reinterpret_cast<uint64_t>(buffer);
+			sqe.len = size;
+			sqe.user_data = user_data;
+
+			sq_array[index] = index;
+			__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+			while (true) {
+				const long ret = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+
+				if (ret >= 0)
+					return (ret == 1);
+				if (errno != EINTR)
+					break;
+			}
+
+			// take the entry back, nothing was consumed
+			__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+			return false;
+		}
+
+		// blocks until a completion is available and returns it
+		io_uring_cqe reap() {
+			while (true) {
+				const uint32_t head = *cq_head;
+
+				if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+					const io_uring_cqe cqe = cqes[head & cq_mask];
+
+					__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+					return cqe;
+				}
+
+				syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			}
+		}
+
+	private:
+		void* map_ring(size_t size, off_t offset) {
+			void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+			return ((addr != MAP_FAILED)? addr: nullptr);
+		}
+
+	private:
+		int ring_fd = -1;
+
+		void* sq_addr = nullptr;
+		void* cq_addr = nullptr;
+		void* sqe_addr = nullptr;
+
+		size_t sq_size = 0;
+		size_t cq_size = 0;
+		size_t sqe_size = 0;
+
+		uint32_t* sq_tail = nullptr;
+		uint32_t* sq_array = nullptr;
+		uint32_t sq_mask = 0;
+
+		uint32_t* cq_head = nullptr;
+		uint32_t* cq_tail = nullptr;
+		uint32_t cq_mask = 0;
+
+		io_uring_sqe* sqes = nullptr;
+		io_uring_cqe* cqes = nullptr;
+	};
+
+	// null if io_uring is not available (old kernel, seccomp, ...)
+	static io_ring* get_thread_ring() {
+		// once setup has failed on any thread, nobody retries
+		static std::atomic<bool> ring_unavailable = {false};
+		static thread_local std::unique_ptr<io_ring> ring;
+		static thread_local bool ring_initialized = false;
+
+		if (ring_initialized)
+			return ring.get();
+
+		ring_initialized = true;
+
+		if (ring_unavailable.load(std::memory_order_relaxed))
+			return nullptr;
+
+		if (ring = std::make_unique<io_ring>(); !ring->init()) {
+			ring.reset();
+			ring_unavailable.store(true, std::memory_order_relaxed);
+		}
+
+		return ring.get();
+	}
+
+
+	struct aio_fallback_pool {
+	public:
+		aio_fallback_pool() {
+			for (size_t i = 0; i < AIO_FALLBACK_THREADS; ++i) {
+				threads.emplace_back(&aio_fallback_pool::run_worker, this);
+			}
+		}
+		~aio_fallback_pool() {
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				shutdown = true;
+			}
+
+			queue_cond.notify_all();
+
+			for (std::thread& t: threads) {
+				t.join();
+			}
+		}
+
+		static aio_fallback_pool& get_instance() {
+			static aio_fallback_pool pool;
+			return pool;
+		}
+
+		void submit(async_reader* reader, async_reader::read_slot* slot) {
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				requests.emplace_back(reader, slot);
+			}
+
+			queue_cond.notify_one();
+		}
+
+	private:
+		void run_worker() {
+			while (true) {
+				std::pair<async_reader*, async_reader::read_slot*> request;
+
+				{
+					std::unique_lock<std::mutex> lock(queue_mutex);
+					queue_cond.wait(lock, [this]() { return (shutdown || !requests.empty()); });
+
+					if (requests.empty())
+						return;
+
+					request = requests.front();
+					requests.pop_front();
+				}
+
+				async_reader::read_slot& slot = *request.second;
+				request.first->complete(slot, request.first->file.read(slot.offset, slot.buffer, slot.size));
+			}
+		}
+
+	private:
+		std::vector<std::thread> threads;
+		std::deque<std::pair<async_reader*, async_reader::read_slot*>> requests;
+
+		std::mutex queue_mutex;
+		std::condition_variable queue_cond;
+
+		bool shutdown = false;
+	};
+
+
+	async_reader::async_reader(const pread_file& f, size_t queue_depth): file(f), ring(get_thread_ring()), read_slots(std::clamp<size_t>(queue_depth, 1, AIO_RING_ENTRIES)) {
+	}
+
+	async_reader::~async_reader() {
+		// in-flight reads still point into the slots
+		for (const read_slot& slot: read_slots) {
+			if (slot.pending)
+				wait(slot.ticket);
+		}
+	}
+
+	const char* async_reader::get_backend_name() {
+		return ((get_thread_ring() != nullptr)? "io_uring": "threads");
+	}
+
+
+	uint64_t async_reader::submit(size_t offset, char* buffer, size_t size) {
+		const uint64_t ticket = next_ticket++;
+
+		read_slot& slot = read_slots[ticket % read_slots.size()];
+
+		slot.reader = this;
+		slot.ticket = ticket;
+		slot.offset = offset;
+		slot.size = size;
+		slot.buffer = buffer;
+		slot.num_read = 0;
+		slot.pending = true;
+		slot.done = false;
+
+		add_perf_counter(PERF_COUNTER_READS, 1);
+
+		if (ring != nullptr) {
+			// a read that can not be queued is done right away
+			if (!ring->submit(file.get_file_desc(), offset, buffer, size, reinterpret_cast<uint64_t>(&slot)))
+				complete(slot, file.read(offset, buffer, size));
+
+			return ticket;
+		}
+
+		aio_fallback_pool::get_instance().submit(this, &slot);
+		return ticket;
+	}
+
+	size_t async_reader::wait(uint64_t ticket) {
+		read_slot& slot = read_slots[ticket % read_slots.size()];
+
+		if (ring != nullptr) {
+			// completions of other readers on this thread are handed to their own slots
+			while (!slot.done) {
+				const io_uring_cqe cqe = ring->reap();
+				read_slot& cqe_slot = *reinterpret_cast<read_slot*>(cqe.user_data);
+				async_reader& cqe_reader = *cqe_slot.reader;
+
+				if (cqe.res < 0) {
+					// retry failed reads synchronously, that also reports EOF properly
+					cqe_reader.complete(cqe_slot, cqe_reader.file.read(cqe_slot.offset, cqe_slot.buffer, cqe_slot.size));
+				} else if (size_t(cqe.res) < cqe_slot.size) {
+					// short read, fetch the remainder (if any) synchronously
+					cqe_reader.complete(cqe_slot, cqe.res + cqe_reader.file.read(cqe_slot.offset + cqe.res, cqe_slot.buffer + cqe.res, cqe_slot.size - cqe.res));
+				} else {
+					cqe_reader.complete(cqe_slot, cqe.res);
+				}
+			}
+		} else {
+			std::unique_lock<std::mutex> lock(slot_mutex);
+			slot_cond.wait(lock, [&]() { return slot.done; });
+		}
+
+		slot.pending = false;
+		return slot.num_read;
+	}
+
+	void async_reader::complete(read_slot& slot, size_t num_read) {
+		add_perf_counter(PERF_COUNTER_READ_BYTES, num_read);
+
+		// io_uring completions are reaped by the owning thread itself
+		if (ring != nullptr) {
+			slot.num_read = num_read;
+			slot.done = true;
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(slot_mutex);
+
+			slot.num_read = num_read;
+			slot.done = true;
+		}
+
+		slot_cond.notify_all();
+	}
+}
+
@@ -0,0 +1,79 @@
+#ifndef HAPINESS_AIO_UTIL_HDR
+#define HAPINESS_AIO_UTIL_HDR
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace util {
+	class io_ring;
+	class pread_file;
+
+	// keeps positional reads of a file in flight while the caller works on earlier ones;
+	// reads go through a per-thread io_uring if the kernel allows it and through a shared
+	// pool of reader threads otherwise
+	// note: not thread-safe, every extracting thread uses its own reader (and the ring of
+	// the thread that constructed it)
+	class async_reader {
+	public:
+		async_reader(const pread_file& file, size_t queue_depth);
+		async_reader(const async_reader&) = delete;
+		// waits for reads that are still in flight
+		~async_reader();
+
+		async_reader& operator = (const async_reader&) = delete;
+
+		// queues a read of <size> bytes at <offset> into <buffer> and returns its ticket
+		// note: at most <queue_depth> reads may be pending (submitted but not waited for)
+		uint64_t submit(size_t offset, char* buffer, size_t size);
+		// blocks until read <ticket> is done and returns the number of bytes read, which
+		// is less than requested only at EOF or on error
+		size_t wait(uint64_t ticket);
+
+		size_t get_queue_depth() const { return read_slots.size(); }
+
+		// "io_uring" or "threads"
+		static const char* get_backend_name();
+
+	private:
+		friend struct aio_fallback_pool;
+
+		struct read_slot {
+			// completions can be reaped by another reader on the same thread, which hands
+			// them back through <reader>
+			async_reader* reader = nullptr;
+
+			uint64_t ticket = 0;
+
+			size_t offset = 0;
+			size_t size = 0;
+			char* buffer = nullptr;
+
+			size_t num_read = 0;
+
+			bool pending = false;
+			bool done = false;
+		};
+
+		void complete(read_slot& slot, size_t num_read);
+
+	private:
+		const pread_file& file;
+
+		// owning thread's ring, null for the fallback backend
+		io_ring* ring = nullptr;
+
+		std::vector<read_slot> read_slots;
+
+		// fallback backend only
+		std::mutex slot_mutex;
+		std::condition_variable slot_cond;
+
+		uint64_t next_ticket = 0;
+	};
+}
+
+#endif
+
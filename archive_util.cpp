@@ -1,76 +1,183 @@
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
 #include <numeric>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aio_util.hpp"
 #include "archive_util.hpp"
+#include "crypt_util.hpp"
 #include "decompress_util.hpp"
+#include "stats_util.hpp"
 #include "string_util.hpp"
+#include "thread_util.hpp"
 
 namespace util {
-	// decrypt buffer with <key> and <seed> (position of the starting byte)
-	static bool decrypt_buffer(uint8_t key, uint8_t seed, char* buffer, size_t buffer_size) {
-		if (key == 0)
-			return false;
+	// batch extraction keeps the OS reading this far ahead of the current file
+	static constexpr size_t BATCH_READAHEAD_SIZE = 8 << 20;
+	// files closer together than this are read ahead as one range
+	static constexpr size_t BATCH_READAHEAD_GAP = 256 << 10;
+	// a thread's scratch keeps buffers up to this size between extractions; larger ones
+	// (e.g. the raw data of a big file read in one go) are freed when the lease ends
+	static constexpr size_t THREAD_SCRATCH_KEEP_SIZE = 4 << 20;
 
-		for (size_t i = 0; i < buffer_size; ++i) {
-			const uint8_t pos = seed + static_cast<uint8_t>(i);
-			const uint8_t dec = buffer[i] ^ (pos ^ key);
 
-			buffer[i] = dec;
-		}
+	static thread_local hpi_archive::extract_scratch thread_scratch;
+	static thread_local bool thread_scratch_in_use = false;
 
-		return true;
+	template<typename T>
+	static void trim_scratch_buffer(T& buffer) {
+		if ((buffer.capacity() * sizeof(typename T::value_type)) <= THREAD_SCRATCH_KEEP_SIZE)
+			return;
+
+		T().swap(buffer);
 	}
 
-	static void read_decrypt_buffer(std::istream& stream, uint8_t key, char* buffer, size_t size) {
-		const uint8_t seed = static_cast<uint8_t>(stream.tellg());
+	static void trim_thread_scratch() {
+		trim_scratch_buffer(thread_scratch.chunk_sizes);
+		trim_scratch_buffer(thread_scratch.chunks);
+		trim_scratch_buffer(thread_scratch.chunk_buffer);
+		trim_scratch_buffer(thread_scratch.block_buffer);
+		trim_scratch_buffer(thread_scratch.region_buffer);
 
-		stream.read(buffer, size);
-		decrypt_buffer(key, seed, buffer, stream.gcount());
+		for (scratch_buffer& buffer: thread_scratch.read_buffers) {
+			trim_scratch_buffer(buffer);
+		}
 	}
 
+	// hands out <scratch> if given and the calling thread's scratch otherwise, unless an
+	// extraction further up this thread's stack (one whose sink is running) holds that
+	class scratch_lease {
+	public:
+		scratch_lease(hpi_archive::extract_scratch* scratch): leased_scratch(scratch) {
+			if (leased_scratch != nullptr)
+				return;
+
+			if (thread_scratch_in_use) {
+				local_scratch = std::make_unique<hpi_archive::extract_scratch>();
+				leased_scratch = local_scratch.get();
+				return;
+			}
 
-	template <typename T>
-	static T read_raw_value(std::istream& stream) {
-		T val;
-		stream.read(reinterpret_cast<char*>(&val), sizeof(T));
-		return val;
-	}
+			thread_scratch_in_use = true;
+			leased_scratch = &thread_scratch;
+		}
+		scratch_lease(const scratch_lease&) = delete;
+		~scratch_lease() {
+			if (leased_scratch != &thread_scratch)
+				return;
 
-	template <typename T>
-	static T read_decrypt_raw_value(std::istream& stream, uint8_t key) {
-		T val;
-		read_decrypt_buffer(stream, key, reinterpret_cast<char*>(&val), sizeof(T));
-		return val;
-	}
+			trim_thread_scratch();
+			thread_scratch_in_use = false;
+		}
+
+		scratch_lease& operator = (const scratch_lease&) = delete;
+
+		hpi_archive::extract_scratch& get() const { return *leased_scratch; }
+
+	private:
+		hpi_archive::extract_scratch* leased_scratch = nullptr;
+
+		std::unique_ptr<hpi_archive::extract_scratch> local_scratch;
+	};
 
-	template <typename T>
-	static void read_decrypt_raw_array(std::istream& stream, uint8_t key, T* buffer, size_t size) {
-		read_decrypt_buffer(stream, key, reinterpret_cast<char*>(buffer), sizeof(T) * size);
+
+	// decrypt, validate and decode the data of a single chunk and return it, still compressed
+	// note: the result is either <raw_data> or points into <chunk_buffer>
+	static const char* decode_chunk(const hpi_chunk& chunk_header, const char* raw_data, uint8_t key, uint8_t seed, scratch_buffer& chunk_buffer, size_t chunk_index) {
+		const char* chunk_data = raw_data;
+
+		uint32_t checksum = 0;
+		char error[256];
+
+		if (key != 0 || chunk_header.encoded != 0) {
+			// decryption, checksum and decoding all happen in one pass, which is accounted
+			// as decoding for encoded chunks and as decryption otherwise
+			const perf_timer timer((chunk_header.encoded != 0)? PERF_COUNTER_DECODE_NS: PERF_COUNTER_DECRYPT_NS);
+
+			add_perf_counter((chunk_header.encoded != 0)? PERF_COUNTER_DECODE_BYTES: PERF_COUNTER_DECRYPT_BYTES, chunk_header.compressed_size);
+			checksum = decrypt_chunk_buffer(key, seed, raw_data, resize_scratch_buffer(chunk_buffer, chunk_header.compressed_size), chunk_header.compressed_size, chunk_header.encoded != 0);
+			chunk_data = chunk_buffer.data();
+		} else {
+			const perf_timer timer(PERF_COUNTER_CHECKSUM_NS);
+
+			add_perf_counter(PERF_COUNTER_CHECKSUM_BYTES, chunk_header.compressed_size);
+			checksum = compute_buffer_checksum(raw_data, chunk_header.compressed_size);
+		}
+
+		if (checksum != chunk_header.checksum) {
+			snprintf(error, sizeof(error) - 1, "[%s] invalid buffer checksum %u for chunk %lu", __func__, checksum, chunk_index);
+			throw hpi_exception(error);
+			return nullptr;
+		}
+
+		return chunk_data;
 	}
 
+	// decrypt, validate, decode and decompress a single chunk from <raw_data> into <out>
+	// and return the number of bytes written
+	// note: <raw_data> may point into <chunk_buffer>, which is (re)used as scratch space
+	static size_t extract_chunk(const hpi_chunk& chunk_header, const char* raw_data, uint8_t key, uint8_t seed, scratch_buffer& chunk_buffer, zlib_context& zlib_ctx, char* out, size_t chunk_index) {
+		char error[256];
 
-	// note: "decrypt" would be a misnomer here
-	static void decode_chunk_buffer(char* buffer, size_t size) {
-		#if 1
-		std::transform(buffer, buffer + size, buffer, [&](char& b) { return ((b - (&b - buffer)) ^ (&b - buffer)); });
-		#else
-		for (size_t i = 0; i < size; ++i) {
-			const uint8_t pos = static_cast<uint8_t>(i);
-			const uint8_t dec = (buffer[i] - pos) ^ pos;
-			buffer[i] = dec;
+		add_perf_counter(PERF_COUNTER_CHUNKS, 1);
+
+		const char* chunk_data = decode_chunk(chunk_header, raw_data, key, seed, chunk_buffer, chunk_index);
+
+		switch (chunk_header.compression_type) {
+			case COMPRESSION_TYPE_NULL: {
+				if (chunk_header.compressed_size != chunk_header.decompressed_size) {
+					snprintf(error, sizeof(error) - 1, "[%s] size mismatch (%u vs %u) for uncompressed chunk %lu", __func__, chunk_header.decompressed_size, chunk_header.compressed_size, chunk_index);
+					throw hpi_exception(error);
+					return 0;
+				}
+
+				std::copy(chunk_data, chunk_data + chunk_header.compressed_size, out);
+				return chunk_header.compressed_size;
+			} break;
+
+			case COMPRESSION_TYPE_LZ77: {
+				return (decompress_lz77(chunk_data, chunk_header.compressed_size, out, chunk_header.decompressed_size));
+			} break;
+
+			case COMPRESSION_TYPE_ZLIB: {
+				return (decompress_zlib(zlib_ctx, chunk_data, chunk_header.compressed_size, out, chunk_header.decompressed_size));
+			} break;
+
+			default: {
+			} break;
 		}
-		#endif
+
+		snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u for chunk %lu", __func__, chunk_header.compression_type, chunk_index);
+		throw hpi_exception(error);
+		return 0;
 	}
 
-	static uint32_t compute_buffer_checksum(const char* buffer, size_t size) {
-		// note: binop LHS has to be uint32_t due to definition of accumulate
-		return (std::accumulate(buffer, buffer + size, 0u, [](uint32_t sum, char byte) { return (sum + static_cast<uint8_t>(byte)); }));
+	// as extract_chunk, but also requires the chunk to decompress to exactly its stated size
+	static void verify_chunk(const hpi_chunk& chunk_header, const char* raw_data, uint8_t key, uint8_t seed, scratch_buffer& chunk_buffer, scratch_buffer& out_buffer, size_t chunk_index) {
+		char* out = resize_scratch_buffer(out_buffer, chunk_header.decompressed_size);
+
+		const size_t num_bytes = extract_chunk(chunk_header, raw_data, key, seed, chunk_buffer, zlib_context::get_thread_context(), out, chunk_index);
+
+		if (num_bytes == chunk_header.decompressed_size)
+			return;
+
+		char error[256];
+		snprintf(error, sizeof(error) - 1, "[%s] chunk %lu decompressed to %lu instead of %u bytes", __func__, chunk_index, num_bytes, chunk_header.decompressed_size);
+		throw hpi_exception(error);
 	}
 
 
 	hpi_archive::arch_entry
-	hpi_archive::make_arch_entry(const hpi_arch_entry& entry, const std::vector<char>& buffer) {
-		const size_t name_size = str_size(buffer.data() + entry.name_offset, buffer.data() + buffer.size());
+	hpi_archive::make_arch_entry(const hpi_arch_entry& entry) const {
+		const std::vector<char>& buffer = directory_buffer;
+
+		const size_t name_ofs = std::min(size_t(entry.name_offset), buffer.size());
+		const size_t name_size = str_size(buffer.data() + name_ofs, buffer.data() + buffer.size());
 		const size_t entry_ofs = entry.data_offset;
 
 		char error[256];
@@ -88,9 +195,12 @@ namespace util {
 				return {};
 			}
 
-			const hpi_path_data* hpd = reinterpret_cast<const hpi_path_data*>(buffer.data() + entry_ofs);
-			const     path_data   pd = std::move(make_path_data(*hpd, buffer));
-			return {{buffer.data() + entry.name_offset, name_size}, pd};
+			// entries are filled in by make_entry_list once all siblings are in the table,
+			// or (lazily) by get_entries; until then the list refers to the raw path data
+			path_data pd;
+			pd.entries = {nullptr, static_cast<uint32_t>(entry_ofs)};
+
+			return {{buffer.data() + name_ofs, name_size}, pd};
 		}
 
 		if ((entry_ofs + sizeof(hpi_file_data)) > buffer.size()) {
@@ -100,40 +210,242 @@ namespace util {
 		}
 
 		const hpi_file_data* hfd = reinterpret_cast<const hpi_file_data*>(buffer.data() + entry_ofs);
-		const     file_data   fd = std::move(make_file_data(*hfd));
-		return {{buffer.data() + entry.name_offset, name_size}, fd};
+		const     file_data   fd = make_file_data(*hfd);
+		return {{buffer.data() + name_ofs, name_size}, fd};
 	}
 
 
-	hpi_archive::path_data
-	hpi_archive::make_path_data(const hpi_path_data& path, const std::vector<char>& buffer) {
+	hpi_archive::entry_list
+	hpi_archive::make_entry_list(const hpi_path_data& path, bool lazy) {
+		const std::vector<char>& buffer = directory_buffer;
+
+		const size_t list_ofs = path.entry_list_offset;
+		const size_t list_end = list_ofs + path.number_of_entries * sizeof(hpi_arch_entry);
+
 		char error[256];
 
-		if ((path.entry_list_offset + (path.number_of_entries * sizeof(hpi_arch_entry))) > buffer.size()) {
+		if (list_end > buffer.size()) {
 			snprintf(error, sizeof(error) - 1, "[%s] dir-entry list offset greater than size %lu", __func__, buffer.size());
 			throw hpi_exception(error);
 			return {};
 		}
 
-		const char* path_start_addr = buffer.data() + path.entry_list_offset;
-		const hpi_arch_entry* hpi_path_entries = reinterpret_cast<const hpi_arch_entry*>(path_start_addr);
+		// capacity is reserved up-front so entry pointers stay valid; this can only be
+		// exceeded if entry lists are shared between (or cyclically nested) directories
+		if ((entry_table.size() + path.number_of_entries) > entry_table.capacity()) {
+			snprintf(error, sizeof(error) - 1, "[%s] more entries than fit in directory of size %lu", __func__, buffer.size());
+			throw hpi_exception(error);
+			return {};
+		}
+
+		const hpi_arch_entry* hpi_path_entries = reinterpret_cast<const hpi_arch_entry*>(buffer.data() + list_ofs);
+
+		const size_t first = entry_table.size();
+		const size_t count = path.number_of_entries;
+
+		for (size_t i = 0; i < count; ++i) {
+			entry_table.push_back(make_arch_entry(hpi_path_entries[i]));
+		}
+
+		// note: capacity is reserved, readers of other blocks never see a reallocation
+		lookup_table.resize(first + count);
 
-		std::vector<arch_entry> v(path.number_of_entries);
+		{
+			const auto beg = lookup_table.begin() + first;
+			const auto end = lookup_table.begin() + first + count;
+			const auto cmp = [&](uint32_t a, uint32_t b) { return (str_compare_nocase(entry_table[first + a].name, entry_table[first + b].name) < 0); };
 
-		for (size_t i = 0, n = v.size(); i < n; ++i) {
-			v[i] = std::move(make_arch_entry(hpi_path_entries[i], buffer));
+			// stable, so lookups still resolve (case-)duplicate names to the first entry
+			std::iota(beg, end, 0);
+			std::stable_sort(beg, end, cmp);
 		}
 
-		return {std::move(v)};
+		// depth-first; sub-directories append their own blocks after this one
+		for (size_t i = 0; i < count; ++i) {
+			if (hpi_path_entries[i].is_path == 0)
+				continue;
+
+			if (lazy) {
+				materialized_paths[first + i].store(0, std::memory_order_relaxed);
+				continue;
+			}
+
+			const hpi_path_data* hpd = reinterpret_cast<const hpi_path_data*>(buffer.data() + hpi_path_entries[i].data_offset);
+			const    entry_list   el = make_entry_list(*hpd, false);
+
+			boost::get<path_data>(entry_table[first + i].data).entries = el;
+		}
+
+		return {entry_table.data() + first, static_cast<uint32_t>(count)};
+	}
+
+	void hpi_archive::advise_willneed(size_t offset, size_t size) const {
+		// streams get no readahead hints
+		if (mapping.is_open()) {
+			mapping.advise_willneed(offset, size);
+			return;
+		}
+
+		reader.advise_willneed(offset, size);
+	}
+
+	size_t hpi_archive::read_buffer(size_t offset, char* buffer, size_t size) const {
+		add_perf_counter(PERF_COUNTER_READS, 1);
+
+		if (mapping.is_open()) {
+			if (offset >= mapping.size())
+				return 0;
+
+			size = std::min(size, mapping.size() - offset);
+
+			add_perf_counter(PERF_COUNTER_READ_BYTES, size);
+			std::memcpy(buffer, mapping.data() + offset, size);
+			return size;
+		}
+
+		if (reader.is_open()) {
+			size = reader.read(offset, buffer, size);
+
+			add_perf_counter(PERF_COUNTER_READ_BYTES, size);
+			return size;
+		}
+
+		// streams have a single shared position
+		const std::lock_guard<std::mutex> lock(*stream_mutex);
+
+		stream->seekg(offset);
+		stream->read(buffer, size);
+
+		add_perf_counter(PERF_COUNTER_READ_BYTES, stream->gcount());
+		return (stream->gcount());
+	}
+
+	size_t hpi_archive::read_decrypt_buffer(size_t offset, char* buffer, size_t size) const {
+		// seed is the (truncated) position of the starting byte
+		const uint8_t seed = static_cast<uint8_t>(offset);
+		const char* src = buffer;
+
+		if (mapping.is_open()) {
+			if (offset >= mapping.size())
+				return 0;
+
+			size = std::min(size, mapping.size() - offset);
+
+			// decrypt straight out of the mapping, no intermediate copy
+			src = mapping.data() + offset;
+
+			add_perf_counter(PERF_COUNTER_READS, 1);
+			add_perf_counter(PERF_COUNTER_READ_BYTES, size);
+		} else {
+			size = read_buffer(offset, buffer, size);
+		}
+
+		// unencrypted data read straight into <buffer> is already in place
+		if (decrypt_key == 0 && src == buffer)
+			return size;
+
+		// unencrypted data is only copied out of the mapping
+		if (decrypt_key == 0 || !is_perf_stats_enabled()) {
+			decrypt_buffer(decrypt_key, seed, src, buffer, size);
+			return size;
+		}
+
+		const perf_timer timer(PERF_COUNTER_DECRYPT_NS);
+
+		add_perf_counter(PERF_COUNTER_DECRYPT_BYTES, size);
+		decrypt_buffer(decrypt_key, seed, src, buffer, size);
+		return size;
+	}
+
+	const char* hpi_archive::read_raw_chunk_buffer(size_t offset, size_t size, scratch_buffer& chunk_buffer) const {
+		// mapped chunks are consumed in-place
+		if (mapping.is_open() && size <= mapping.size() && offset <= (mapping.size() - size)) {
+			add_perf_counter(PERF_COUNTER_READS, 1);
+			add_perf_counter(PERF_COUNTER_READ_BYTES, size);
+			return (mapping.data() + offset);
+		}
+
+		char* data = resize_scratch_buffer(chunk_buffer, size);
+
+		// a truncated chunk reads as zero-padded, as it would from a fresh buffer
+		std::fill(data + read_buffer(offset, data, size), data + size, 0);
+		return data;
 	}
 
+
 	bool hpi_archive::open(std::istream* istream) {
 		// note: caller must open stream
-		const hpi_version archive_version = read_raw_value<hpi_version>(*(stream = istream));
-		const hpi_header archive_header = read_raw_value<hpi_header>(*stream);
+		stream = istream;
+		stream_mutex = std::make_unique<std::mutex>();
+
+		mapping.close();
+		reader.close();
+		return (open_archive(lazy_directories));
+	}
+
+	bool hpi_archive::open(const std::string& file_path) {
+		// asynchronous reads need a file descriptor, mapped pages fault in synchronously
+		if (mapped_reads && read_queue_depth == 0 && mapping.open(file_path)) {
+			reader.close();
+		} else {
+			mapping.close();
+
+			if (!reader.open(file_path))
+				return false;
+		}
+
+		stream = nullptr;
+		stream_mutex.reset();
+
+		if (!index_dir.empty())
+			return (open_indexed(file_path));
+
+		return (open_archive(lazy_directories));
+	}
+
+	bool hpi_archive::open_indexed(const std::string& file_path) {
+		const std::string archive_path = get_canonical_path(file_path);
+		const std::string index_path = make_index_path(index_dir, archive_path);
+
+		archive_file_stamp stamp;
+
+		if (!get_archive_file_stamp(archive_path, stamp))
+			return (open_archive(lazy_directories));
+
+		if (load_index(index_path, archive_path, stamp))
+			return true;
+
+		// (re)build the sidecar from a full parse; failing to write it is not an error
+		if (!open_archive(false))
+			return false;
+
+		save_index(index_path, archive_path, stamp);
+		return true;
+	}
+
+	bool hpi_archive::open_archive(bool lazy) {
+		const perf_timer timer(PERF_COUNTER_OPEN_NS);
+
+		hpi_version archive_version;
+		hpi_header archive_header;
 		char error[256];
 
-		std::vector<char> buffer;
+		std::vector<char>& buffer = directory_buffer;
+
+		add_perf_counter(PERF_COUNTER_OPENS, 1);
+
+		// cached files belong to the previous archive
+		if (file_cache != nullptr)
+			file_cache->clear();
+
+		index_mapping.close();
+		file_path_index = std::make_unique<path_index>();
+		chunk_files = nullptr;
+		chunk_offsets = nullptr;
+		num_chunk_files = 0;
+
+		read_buffer(0, reinterpret_cast<char*>(&archive_version), sizeof(archive_version));
+		read_buffer(sizeof(archive_version), reinterpret_cast<char*>(&archive_header), sizeof(archive_header));
 
 		if (archive_version.magic != HPI_MAGIC_NUMBER) {
 			snprintf(error, sizeof(error) - 1, "[%s] invalid HPI magic-number %u", __func__, archive_version.magic);
@@ -148,259 +460,1278 @@ namespace util {
 		}
 
 		// transform key
-		decrypt_key |= (static_cast<uint8_t>(archive_header.header_key) << 2);
+		decrypt_key  = (static_cast<uint8_t>(archive_header.header_key) << 2);
 		decrypt_key |= (static_cast<uint8_t>(archive_header.header_key) >> 6);
 
-		stream->seekg(archive_header.start);
-		buffer.resize(archive_header.directory_size, 0);
-		read_decrypt_buffer(*stream, decrypt_key, buffer.data() + archive_header.start, archive_header.directory_size - archive_header.start);
-
 		if ((archive_header.start + sizeof(hpi_path_data)) > archive_header.directory_size) {
 			snprintf(error, sizeof(error) - 1, "[%s] root-dir offset %lu greater than dir-size %u", __func__, archive_header.start + sizeof(hpi_path_data), archive_header.directory_size);
 			throw hpi_exception(error);
 			return false;
 		}
 
-		root_path = std::move(make_path_data(*reinterpret_cast<hpi_path_data*>(buffer.data() + archive_header.start), buffer));
+		buffer.clear();
+		buffer.resize(archive_header.directory_size, 0);
+		read_decrypt_buffer(archive_header.start, buffer.data() + archive_header.start, archive_header.directory_size - archive_header.start);
+
+		// every entry takes up at least sizeof(hpi_arch_entry) bytes of the directory
+		// note: the reserved tail is never touched and costs no physical memory
+		const size_t max_entries = (archive_header.directory_size - archive_header.start) / sizeof(hpi_arch_entry);
+
+		entry_table.clear();
+		entry_table.reserve(max_entries);
+		lookup_table.clear();
+		lookup_table.reserve(max_entries);
+
+		if (lazy) {
+			// flags are only written (and their pages touched) as entries are added
+			materialized_paths.reset(new std::atomic<uint8_t>[max_entries]);
+			materialize_mutex = std::make_unique<std::mutex>();
+		} else {
+			materialized_paths.reset();
+			materialize_mutex.reset();
+		}
+
+		root_path.entries = make_entry_list(*reinterpret_cast<hpi_path_data*>(buffer.data() + archive_header.start), lazy);
 		return true;
 	}
 
 
-	bool hpi_archive::extract(const hpi_archive::file_data& file, std::vector<char>& buffer) const {
-		switch (file.compression_type) {
-			case COMPRESSION_TYPE_NULL: {
-				stream->seekg(file.offset);
-				// stream->read(buffer.data(), file.size);
-				read_decrypt_buffer(*stream, decrypt_key, buffer.data(), file.size);
-				return true;
-			} break;
-			case COMPRESSION_TYPE_LZ77:
-			case COMPRESSION_TYPE_ZLIB: {
-				return (extract_compressed(file, buffer));
-			} break;
-			default: {
-			} break;
-		}
+	bool hpi_archive::load_index(const std::string& index_path, const std::string& archive_path, const archive_file_stamp& stamp) {
+		const perf_timer timer(PERF_COUNTER_OPEN_NS);
 
-		char error[256];
-		snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u", __func__, file.compression_type);
-		throw hpi_exception(error);
-		return false;
-	}
+		mapped_file index;
+		hpi_index_header header;
 
-	bool hpi_archive::extract_compressed(const hpi_archive::file_data& file, std::vector<char>& buffer) const {
-		char error[256];
+		if (!index.open(index_path) || index.size() < sizeof(hpi_index_header))
+			return false;
 
-		// add one extra chunk if size is not a multiple of 64K
-		std::vector<uint32_t> chunk_sizes((file.size / 65536) + ((file.size % 65536) != 0), 0);
-		std::vector<char> chunk_buffer;
+		std::memcpy(&header, index.data(), sizeof(header));
 
-		stream->seekg(file.offset);
-		read_decrypt_raw_array(*stream, decrypt_key, chunk_sizes.data(), chunk_sizes.size());
+		if (header.magic != HPI_INDEX_MAGIC_NUMBER || header.version != HPI_INDEX_VERSION_NUMBER || !(header.stamp == stamp))
+			return false;
 
-		for (size_t i = 0, buffer_offset = 0, n = chunk_sizes.size(); i < n; ++i) {
-			const hpi_chunk chunk_header = read_decrypt_raw_value<hpi_chunk>(*stream, decrypt_key);
+		// section offsets; sizes are 32-bit, so none of these can overflow
+		const size_t path_ofs = sizeof(hpi_index_header);
+		const size_t names_ofs = path_ofs + align_index_section(header.path_size);
+		const size_t entries_ofs = names_ofs + align_index_section(header.names_size);
+		const size_t lookup_ofs = entries_ofs + align_index_section(size_t(header.num_entries) * sizeof(hpi_index_entry));
+		const size_t chunk_files_ofs = lookup_ofs + align_index_section(size_t(header.num_entries) * sizeof(uint32_t));
+		const size_t chunk_offsets_ofs = chunk_files_ofs + align_index_section(size_t(header.num_chunk_files) * sizeof(hpi_index_chunk_file));
+		const size_t index_size = chunk_offsets_ofs + align_index_section(size_t(header.num_chunks) * sizeof(uint32_t));
 
-			if (chunk_header.magic != HPI_CHUNK_MAGIC_NUMBER) {
-				snprintf(error, sizeof(error) - 1, "[%s] invalid header magic-number %u for chunk %lu", __func__, chunk_header.magic, i);
-				throw hpi_exception(error);
-				return false;
-			}
+		if (index_size != index.size() || header.payload_size != (index_size - sizeof(hpi_index_header)))
+			return false;
+		if (header.path_size != archive_path.size() || std::memcmp(index.data() + path_ofs, archive_path.data(), archive_path.size()) != 0)
+			return false;
+		if (compute_index_checksum(index.data() + sizeof(hpi_index_header), header.payload_size) != header.payload_checksum)
+			return false;
 
-			if ((buffer_offset + chunk_header.decompressed_size) > file.size) {
-				snprintf(error, sizeof(error) - 1, "[%s] extracted file size %lu larger than expected size %lu for chunk %lu", __func__, buffer_offset + chunk_header.decompressed_size, file.size, i);
-				throw hpi_exception(error);
+		const hpi_index_entry* index_entries = reinterpret_cast<const hpi_index_entry*>(index.data() + entries_ofs);
+		const uint32_t* index_lookup = reinterpret_cast<const uint32_t*>(index.data() + lookup_ofs);
+		const hpi_index_chunk_file* index_chunk_files = reinterpret_cast<const hpi_index_chunk_file*>(index.data() + chunk_files_ofs);
+
+		// every lookup block has to hold in-block indices only
+		const auto valid_block = [&](size_t first, size_t count) {
+			if (first > header.num_entries || count > (header.num_entries - first))
 				return false;
-			}
 
-			chunk_buffer.clear();
-			chunk_buffer.resize(chunk_header.compressed_size, 0);
-			read_decrypt_buffer(*stream, decrypt_key, chunk_buffer.data(), chunk_header.compressed_size);
+			return (std::all_of(index_lookup + first, index_lookup + first + count, [&](uint32_t k) { return (k < count); }));
+		};
 
-			const uint32_t checksum = compute_buffer_checksum(chunk_buffer.data(), chunk_header.compressed_size);
+		// the checksum catches damage, these catch sidecars that were never valid
+		if (header.num_root_entries > header.num_entries || !valid_block(0, header.num_root_entries))
+			return false;
 
-			if (checksum != chunk_header.checksum) {
-				snprintf(error, sizeof(error) - 1, "[%s] invalid buffer checksum %u for chunk %lu", __func__, checksum, i);
-				throw hpi_exception(error);
-				return false;
-			}
+		for (size_t i = 0; i < header.num_chunk_files; ++i) {
+			const hpi_index_chunk_file& file = index_chunk_files[i];
+			const size_t num_chunks = (file.file_size / HPI_CHUNK_SIZE) + ((file.file_size % HPI_CHUNK_SIZE) != 0);
 
-			if (chunk_header.encoded != 0)
-				decode_chunk_buffer(chunk_buffer.data(), chunk_header.compressed_size);
+			if (file.first_chunk > header.num_chunks || num_chunks > (header.num_chunks - file.first_chunk))
+				return false;
+			if (i > 0 && file.data_offset <= index_chunk_files[i - 1].data_offset)
+				return false;
+		}
 
-			switch (chunk_header.compression_type) {
-				case COMPRESSION_TYPE_NULL: {
-					if (chunk_header.compressed_size != chunk_header.decompressed_size) {
-						snprintf(error, sizeof(error) - 1, "[%s] size mismatch (%u vs %u) for uncompressed chunk %lu", __func__, chunk_header.decompressed_size, chunk_header.compressed_size, i);
-						throw hpi_exception(error);
-						return false;
-					}
+		// entries are validated as they are built; the table only replaces <entry_table>
+		// if all of them are, which keeps its data (and every path's entry pointers)
+		std::vector<arch_entry> entries;
+		entries.reserve(header.num_entries);
 
-					std::copy(chunk_buffer.data(), chunk_buffer.data() + chunk_header.compressed_size, buffer.data() + buffer_offset);
-					buffer_offset += chunk_header.decompressed_size;
-				} break;
+		for (size_t i = 0; i < header.num_entries; ++i) {
+			const hpi_index_entry& entry = index_entries[i];
 
-				case COMPRESSION_TYPE_LZ77: {
-					decompress_lz77(chunk_buffer.data(), chunk_header.compressed_size, buffer.data() + buffer_offset, chunk_header.decompressed_size);
-					buffer_offset += chunk_header.decompressed_size;
-				} break;
+			if (entry.name_offset > header.names_size || entry.name_size > (header.names_size - entry.name_offset))
+				return false;
 
-				case COMPRESSION_TYPE_ZLIB: {
-					decompress_zlib(chunk_buffer.data(), chunk_header.compressed_size, buffer.data() + buffer_offset, chunk_header.decompressed_size);
-					buffer_offset += chunk_header.decompressed_size;
-				} break;
+			const std::string_view name(index.data() + names_ofs + entry.name_offset, entry.name_size);
 
-				default: {
-					snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u for chunk %lu", __func__, chunk_header.compression_type, i);
-					throw hpi_exception(error);
+			if (entry.is_path != 0) {
+				if (!valid_block(entry.data_offset, entry.data_size))
 					return false;
-				} break;
+
+				path_data pd;
+				pd.entries = {entries.data() + entry.data_offset, entry.data_size};
+
+				entries.push_back({name, pd});
+				continue;
 			}
+
+			if (entry.compression_type > COMPRESSION_TYPE_ZLIB)
+				return false;
+
+			entries.push_back({name, file_data{entry.data_offset, entry.data_size, entry.compression_type}});
 		}
 
-		return true;
-	}
+		add_perf_counter(PERF_COUNTER_OPENS, 1);
 
+		if (file_cache != nullptr)
+			file_cache->clear();
 
-	#ifdef USE_STD_OPTIONAL
-	struct file_to_opt_visitor: public boost::static_visitor<std::optional<std::reference_wrapper<const hpi_archive::file_data>>> {
-		std::optional<std::reference_wrapper<const hpi_archive::file_data>> operator()(const hpi_archive::file_data& fd) const { return           fd; }
-		std::optional<std::reference_wrapper<const hpi_archive::file_data>> operator()(const hpi_archive::path_data&   ) const { return std::nullopt; }
-    };
-
-	struct path_to_opt_visitor: public boost::static_visitor<std::optional<std::reference_wrapper<const hpi_archive::path_data>>> {
-		std::optional<std::reference_wrapper<const hpi_archive::path_data>> operator()(const hpi_archive::file_data&   ) const { return std::nullopt; }
-		std::optional<std::reference_wrapper<const hpi_archive::path_data>> operator()(const hpi_archive::path_data& pd) const { return           pd; }
-	};
-	#endif
+		// nothing left to materialize or parse
+		std::vector<char>().swap(directory_buffer);
+		materialized_paths.reset();
+		materialize_mutex.reset();
 
+		// mapped data does not move with the mapping, names stay valid
+		index_mapping = std::move(index);
+		entry_table = std::move(entries);
 
-	#ifdef USE_STD_OPTIONAL
-	static std::optional<std::reference_wrapper<const hpi_archive::file_data>>
-	#else
-	static const hpi_archive::file_data*
-	#endif
-	find_file_inner(const hpi_archive::path_data& path, const std::string& name) {
-		const auto pred = [name](const hpi_archive::arch_entry& e) { return (str_to_uppercase(e.name) == str_to_uppercase(name)); };
-		const auto iter = std::find_if(path.entries.begin(), path.entries.end(), pred);
+		lookup_table.assign(index_lookup, index_lookup + header.num_entries);
+		root_path.entries = {entry_table.data(), header.num_root_entries};
 
-		#ifdef USE_STD_OPTIONAL
-		if (iter == path.entries.end())
-			return std::nullopt;
+		file_path_index = std::make_unique<path_index>();
 
-		return (boost::apply_visitor(file_to_opt_visitor(), iter->data));
-		#else
-		if (iter == path.entries.end())
-			return nullptr;
+		chunk_files = reinterpret_cast<const hpi_index_chunk_file*>(index_mapping.data() + chunk_files_ofs);
+		chunk_offsets = reinterpret_cast<const uint32_t*>(index_mapping.data() + chunk_offsets_ofs);
+		num_chunk_files = header.num_chunk_files;
 
-		return &boost::get<hpi_archive::file_data>(iter->data);
-		#endif
+		decrypt_key = header.decrypt_key;
+		return true;
 	}
 
+	bool hpi_archive::save_index(const std::string& index_path, const std::string& archive_path, const archive_file_stamp& stamp) const {
+		hpi_index_header header;
 
-	#ifdef USE_STD_OPTIONAL
-	std::optional<std::reference_wrapper<const hpi_archive::file_data>>
-	#else
-	const hpi_archive::file_data*
-	#endif
-	hpi_archive::find_file(const std::string& path_str) const {
-		const std::vector<std::string>& split_path_strs = str_split(path_str, {'/'});
-
-		const path_data* path = &get_root_path();
+		std::vector<hpi_index_entry> index_entries(entry_table.size());
+		std::vector<hpi_index_chunk_file> index_chunk_files;
+		std::vector<uint32_t> index_chunk_offsets;
+		// only the names are kept from the directory block
+		std::string index_names;
 
-		// descend down the archive
-		for (auto comp_iter = split_path_strs.cbegin(), comp_end = --split_path_strs.cend(); comp_iter != comp_end; ++comp_iter) {
-			const std::string& path_comp = *comp_iter;
+		header.stamp = stamp;
+		header.path_size = archive_path.size();
+		header.num_entries = entry_table.size();
+		header.num_root_entries = root_path.entries.size();
+		header.decrypt_key = decrypt_key;
 
-			const auto beg = path->entries.begin();
-			const auto end = path->entries.end();
+		for (size_t i = 0; i < entry_table.size(); ++i) {
+			const arch_entry& entry = entry_table[i];
+			hpi_index_entry& index_entry = index_entries[i];
 
-			const auto pred = [&path_comp](const arch_entry& e) { return (str_to_uppercase(e.name) == str_to_uppercase(path_comp)); };
-			const auto iter = std::find_if(beg, end, pred);
+			index_entry.name_offset = index_names.size();
+			index_entry.name_size = entry.name.size();
 
-			#ifdef USE_STD_OPTIONAL
-			{
-				if (iter == end)
-					return std::nullopt;
+			index_names.append(entry.name);
 
-				const auto found_path = boost::apply_visitor(path_to_opt_visitor(), iter->data);
+			if (const path_data* d = boost::get<path_data>(&entry.data); d != nullptr) {
+				index_entry.data_offset = d->entries.begin() - entry_table.data();
+				index_entry.data_size = d->entries.size();
+				index_entry.is_path = 1;
+			} else {
+				const file_data& f = boost::get<file_data>(entry.data);
 
-				if (!found_path)
-					return std::nullopt;
+				index_entry.data_offset = f.offset;
+				index_entry.data_size = f.size;
+				index_entry.compression_type = f.compression_type;
 
-				path = &(found_path->get());
+				if (f.compression_type != COMPRESSION_TYPE_NULL)
+					index_chunk_files.push_back({f.offset, f.size, 0});
 			}
-			#else
-			{
-				if (iter == end)
-					return nullptr;
+		}
+
+		// entries sharing data share their chunks
+		std::sort(index_chunk_files.begin(), index_chunk_files.end(), [](const hpi_index_chunk_file& a, const hpi_index_chunk_file& b) { return (a.data_offset < b.data_offset); });
+		index_chunk_files.erase(std::unique(index_chunk_files.begin(), index_chunk_files.end(), [](const hpi_index_chunk_file& a, const hpi_index_chunk_file& b) { return (a.data_offset == b.data_offset); }), index_chunk_files.end());
+
+		{
+			std::vector<uint32_t> chunk_sizes;
 
-				const hpi_archive::path_data* found_path = &boost::get<hpi_archive::path_data>(iter->data);
+			size_t num_chunk_files = 0;
 
-				if (found_path == nullptr)
-					return nullptr;
+			// chunk offsets follow from each file's chunk-size table
+			for (const hpi_index_chunk_file& file: index_chunk_files) {
+				chunk_sizes.resize((file.file_size / HPI_CHUNK_SIZE) + ((file.file_size % HPI_CHUNK_SIZE) != 0));
 
-				path = found_path;
+				if (read_decrypt_buffer(file.data_offset, reinterpret_cast<char*>(chunk_sizes.data()), chunk_sizes.size() * sizeof(uint32_t)) != (chunk_sizes.size() * sizeof(uint32_t)))
+					continue;
+
+				size_t chunk_offset = file.data_offset + chunk_sizes.size() * sizeof(uint32_t);
+
+				index_chunk_files[num_chunk_files++] = {file.data_offset, file.file_size, static_cast<uint32_t>(index_chunk_offsets.size())};
+
+				for (const uint32_t chunk_size: chunk_sizes) {
+					index_chunk_offsets.push_back(std::min<size_t>(chunk_offset, std::numeric_limits<uint32_t>::max()));
+					chunk_offset += chunk_size;
+				}
 			}
-			#endif
+
+			index_chunk_files.resize(num_chunk_files);
 		}
 
-		// find file in directory
-		return (find_file_inner(*path, split_path_strs.back()));
-	}
+		header.names_size = index_names.size();
+		header.num_chunk_files = index_chunk_files.size();
+		header.num_chunks = index_chunk_offsets.size();
 
-	#ifdef USE_STD_OPTIONAL
-	std::optional<std::reference_wrapper<const hpi_archive::path_data>>
-	#else
-	const hpi_archive::path_data*
-	#endif
-	hpi_archive::find_path(const std::string& path_str) const {
-		const std::vector<std::string>& split_path_strs = str_split(path_str, {'/'});
+		const size_t path_ofs = sizeof(hpi_index_header);
+		const size_t names_ofs = path_ofs + align_index_section(header.path_size);
+		const size_t entries_ofs = names_ofs + align_index_section(header.names_size);
+		const size_t lookup_ofs = entries_ofs + align_index_section(index_entries.size() * sizeof(hpi_index_entry));
+		const size_t chunk_files_ofs = lookup_ofs + align_index_section(lookup_table.size() * sizeof(uint32_t));
+		const size_t chunk_offsets_ofs = chunk_files_ofs + align_index_section(index_chunk_files.size() * sizeof(hpi_index_chunk_file));
+		const size_t index_size = chunk_offsets_ofs + align_index_section(index_chunk_offsets.size() * sizeof(uint32_t));
 
-		const path_data* path = &get_root_path();
+		std::vector<char> index_data(index_size, 0);
 
-		// descend down the archive
-		for (auto comp_iter = split_path_strs.cbegin(), comp_end = --split_path_strs.cend(); comp_iter != comp_end; ++comp_iter) {
-			const std::string& path_comp = *comp_iter;
+		std::memcpy(index_data.data() + path_ofs, archive_path.data(), archive_path.size());
+		std::memcpy(index_data.data() + names_ofs, index_names.data(), index_names.size());
+		std::memcpy(index_data.data() + entries_ofs, index_entries.data(), index_entries.size() * sizeof(hpi_index_entry));
+		std::memcpy(index_data.data() + lookup_ofs, lookup_table.data(), lookup_table.size() * sizeof(uint32_t));
+		std::memcpy(index_data.data() + chunk_files_ofs, index_chunk_files.data(), index_chunk_files.size() * sizeof(hpi_index_chunk_file));
+		std::memcpy(index_data.data() + chunk_offsets_ofs, index_chunk_offsets.data(), index_chunk_offsets.size() * sizeof(uint32_t));
 
-			const auto beg = path->entries.begin();
-			const auto end = path->entries.end();
+		header.payload_size = index_size - sizeof(hpi_index_header);
+		header.payload_checksum = compute_index_checksum(index_data.data() + sizeof(hpi_index_header), header.payload_size);
 
-			const auto pred = [&path_comp](const arch_entry& e) { return (str_to_uppercase(e.name) == str_to_uppercase(path_comp)); };
-			const auto iter = std::find_if(beg, end, pred);
+		std::memcpy(index_data.data(), &header, sizeof(header));
+		return (write_index_file(index_path, index_data));
+	}
+
+	size_t hpi_archive::find_indexed_chunk(const hpi_archive::file_data& file, size_t chunk_index) const {
+		const hpi_index_chunk_file* end = chunk_files + num_chunk_files;
+		const hpi_index_chunk_file* iter = std::lower_bound(chunk_files, end, file.offset, [](const hpi_index_chunk_file& f, uint32_t offset) { return (f.data_offset < offset); });
 
-			#ifdef USE_STD_OPTIONAL
-			{
-				if (iter == end)
-					return std::nullopt;
+		if (iter == end || iter->data_offset != file.offset || iter->file_size != file.size)
+			return 0;
+		if (chunk_index >= ((file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0)))
+			return 0;
 
-				const auto found_path = boost::apply_visitor(path_to_opt_visitor(), iter->data);
+		return (chunk_offsets[iter->first_chunk + chunk_index]);
+	}
 
-				if (!found_path)
-					return std::nullopt;
 
-				path = &(found_path->get());
-			}
-			#else
-			{
-				if (iter == end)
-					return nullptr;
+	bool hpi_archive::extract(const hpi_archive::file_data& file, std::vector<char>& buffer, extract_scratch* scratch) const {
+		const scratch_lease lease(scratch);
+		return (extract_buffer(file, buffer.data(), lease.get()));
+	}
 
-				const hpi_archive::path_data* found_path = &boost::get<hpi_archive::path_data>(iter->data);
+	bool hpi_archive::extract(const hpi_archive::file_data& file, scratch_buffer& buffer, extract_scratch* scratch) const {
+		const scratch_lease lease(scratch);
+		return (extract_buffer(file, resize_scratch_buffer(buffer, file.size), lease.get()));
+	}
 
-				if (found_path == nullptr)
-					return nullptr;
+	bool hpi_archive::extract_buffer(const hpi_archive::file_data& file, char* buffer, extract_scratch& scratch) const {
+		add_perf_counter(PERF_COUNTER_FILES, 1);
 
-				path = found_path;
-			}
-			#endif
+		switch (file.compression_type) {
+			case COMPRESSION_TYPE_NULL: {
+				read_decrypt_buffer(file.offset, buffer, file.size);
+				return true;
+			} break;
+			case COMPRESSION_TYPE_LZ77:
+			case COMPRESSION_TYPE_ZLIB: {
+				return (extract_compressed(file, buffer, nullptr, scratch));
+			} break;
+			default: {
+			} break;
 		}
 
-		#ifdef USE_STD_OPTIONAL
-		return *path;
-		#else
-		return path;
-		#endif
+		char error[256];
+		snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u", __func__, file.compression_type);
+		throw hpi_exception(error);
+		return false;
 	}
-}
 
+	bool hpi_archive::extract(const hpi_archive::file_data& file, const extract_sink& sink, extract_scratch* scratch) const {
+		const scratch_lease lease(scratch);
+
+		add_perf_counter(PERF_COUNTER_FILES, 1);
+
+		switch (file.compression_type) {
+			case COMPRESSION_TYPE_NULL: {
+				// unencrypted mapped data can be handed out as-is
+				if (mapping.is_open() && decrypt_key == 0 && file.offset <= mapping.size() && file.size <= (mapping.size() - file.offset)) {
+					add_perf_counter(PERF_COUNTER_READS, 1);
+					add_perf_counter(PERF_COUNTER_READ_BYTES, file.size);
+					sink(mapping.data() + file.offset, file.size);
+					return true;
+				}
+
+				scratch_buffer& block_buffer = lease.get().block_buffer;
+
+				resize_scratch_buffer(block_buffer, std::min(file.size, HPI_CHUNK_SIZE));
+
+				for (size_t block_offset = 0; block_offset < file.size; block_offset += block_buffer.size()) {
+					const size_t block_size = std::min(block_buffer.size(), file.size - block_offset);
+
+					read_decrypt_buffer(file.offset + block_offset, block_buffer.data(), block_size);
+					sink(block_buffer.data(), block_size);
+				}
+
+				return true;
+			} break;
+			case COMPRESSION_TYPE_LZ77:
+			case COMPRESSION_TYPE_ZLIB: {
+				return (extract_compressed(file, nullptr, &sink, lease.get()));
+			} break;
+			default: {
+			} break;
+		}
+
+		char error[256];
+		snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u", __func__, file.compression_type);
+		throw hpi_exception(error);
+		return false;
+	}
+
+	bool hpi_archive::extract_to_file(const hpi_archive::file_data& file, int fd) const {
+		const int src_fd = mapping.is_open()? mapping.get_file_desc(): reader.get_file_desc();
+
+		struct stat sb;
+		off_t file_pos = 0;
+
+		if (file.compression_type != COMPRESSION_TYPE_NULL || src_fd == -1)
+			return (extract(file, make_fd_sink(fd)));
+		if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || (file_pos = lseek(fd, 0, SEEK_CUR)) < 0)
+			return (extract(file, make_fd_sink(fd)));
+
+		if (decrypt_key == 0) {
+			if (copy_file_data(src_fd, file.offset, fd, file.size) == file.size) {
+				add_perf_counter(PERF_COUNTER_FILES, 1);
+				add_perf_counter(PERF_COUNTER_READS, 1);
+				add_perf_counter(PERF_COUNTER_READ_BYTES, file.size);
+				return true;
+			}
+
+			// the generic path overwrites whatever part did get copied
+			lseek(fd, file_pos, SEEK_SET);
+			return (extract(file, make_fd_sink(fd)));
+		}
+
+		// pre-size the target so its blocks are allocated once rather than per write (a failure
+		// here is not fatal, the sink reports a full disk); decrypting into a cache-resident block
+		// buffer beat decrypting straight into a shared mapping of the target, which page-faults
+		if (file.size != 0)
+			fallocate(fd, 0, file_pos, file.size);
+
+		return (extract(file, make_fd_sink(fd)));
+	}
+
+	size_t hpi_archive::extract_range(const hpi_archive::file_data& file, size_t offset, size_t length, char* out) const {
+		char error[256];
+
+		if (offset >= file.size)
+			return 0;
+
+		length = std::min(length, file.size - offset);
+
+		// an empty range has no last chunk
+		if (length == 0)
+			return 0;
+
+		switch (file.compression_type) {
+			case COMPRESSION_TYPE_NULL: {
+				return (read_decrypt_buffer(file.offset + offset, out, length));
+			} break;
+			case COMPRESSION_TYPE_LZ77:
+			case COMPRESSION_TYPE_ZLIB: {
+			} break;
+			default: {
+				snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u", __func__, file.compression_type);
+				throw hpi_exception(error);
+				return 0;
+			} break;
+		}
+
+		// every chunk but the last decompresses to exactly HPI_CHUNK_SIZE bytes
+		const size_t num_chunks = (file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0);
+		const size_t first_chunk = offset / HPI_CHUNK_SIZE;
+		const size_t last_chunk = (offset + length - 1) / HPI_CHUNK_SIZE;
+
+		const scratch_lease lease(nullptr);
+
+		scratch_buffer& chunk_buffer = lease.get().chunk_buffer;
+		// holds a partially requested chunk
+		scratch_buffer& range_buffer = lease.get().block_buffer;
+
+		zlib_context& zlib_ctx = zlib_context::get_thread_context();
+
+		size_t chunk_offset = find_indexed_chunk(file, first_chunk);
+
+		if (chunk_offset == 0) {
+			// only the part of the size table up to the first needed chunk is read
+			std::vector<uint32_t>& chunk_sizes = lease.get().chunk_sizes;
+
+			chunk_sizes.assign(first_chunk, 0);
+
+			read_decrypt_buffer(file.offset, reinterpret_cast<char*>(chunk_sizes.data()), chunk_sizes.size() * sizeof(uint32_t));
+
+			chunk_offset = file.offset + num_chunks * sizeof(uint32_t);
+			chunk_offset = std::accumulate(chunk_sizes.begin(), chunk_sizes.end(), chunk_offset);
+		}
+
+		// a table (or index) that disagrees with the headers is not trusted, walk the headers instead
+		if (const hpi_chunk chunk_header = read_decrypt_raw_value<hpi_chunk>(chunk_offset); chunk_header.magic != HPI_CHUNK_MAGIC_NUMBER || chunk_header.decompressed_size != std::min<size_t>(HPI_CHUNK_SIZE, file.size - first_chunk * HPI_CHUNK_SIZE)) {
+			chunk_offset = file.offset + num_chunks * sizeof(uint32_t);
+
+			for (size_t i = 0; i < first_chunk; ++i) {
+				chunk_offset += (sizeof(hpi_chunk) + read_decrypt_raw_value<hpi_chunk>(chunk_offset).compressed_size);
+			}
+		}
+
+		for (size_t i = first_chunk; i <= last_chunk; ++i) {
+			const hpi_chunk chunk_header = read_decrypt_raw_value<hpi_chunk>(chunk_offset);
+
+			const size_t chunk_begin = i * HPI_CHUNK_SIZE;
+			const size_t chunk_size = std::min<size_t>(HPI_CHUNK_SIZE, file.size - chunk_begin);
+
+			if (chunk_header.magic != HPI_CHUNK_MAGIC_NUMBER) {
+				snprintf(error, sizeof(error) - 1, "[%s] invalid header magic-number %u for chunk %lu", __func__, chunk_header.magic, i);
+				throw hpi_exception(error);
+				return 0;
+			}
+
+			if (chunk_header.decompressed_size != chunk_size) {
+				snprintf(error, sizeof(error) - 1, "[%s] decompressed size %u differs from expected size %lu for chunk %lu", __func__, chunk_header.decompressed_size, chunk_size, i);
+				throw hpi_exception(error);
+				return 0;
+			}
+
+			const size_t data_offset = chunk_offset + sizeof(hpi_chunk);
+			const char* raw_data = read_raw_chunk_buffer(data_offset, chunk_header.compressed_size, chunk_buffer);
+
+			// requested part of this chunk, relative to its start
+			const size_t copy_begin = std::max(offset, chunk_begin) - chunk_begin;
+			const size_t copy_end = std::min(offset + length, chunk_begin + chunk_size) - chunk_begin;
+
+			char* chunk_out = out + (chunk_begin + copy_begin - offset);
+
+			if (copy_begin == 0 && copy_end == chunk_size) {
+				extract_chunk(chunk_header, raw_data, decrypt_key, data_offset, chunk_buffer, zlib_ctx, chunk_out, i);
+			} else {
+				resize_scratch_buffer(range_buffer, chunk_size);
+
+				extract_chunk(chunk_header, raw_data, decrypt_key, data_offset, chunk_buffer, zlib_ctx, range_buffer.data(), i);
+				std::copy(range_buffer.data() + copy_begin, range_buffer.data() + copy_end, chunk_out);
+			}
+
+			chunk_offset = data_offset + chunk_header.compressed_size;
+		}
+
+		return length;
+	}
+
+	void hpi_archive::extract_batch(const std::vector<const file_data*>& files, const batch_sink_factory& make_sink) const {
+		struct data_range {
+			size_t begin;
+			size_t end;
+		};
+
+		std::vector<size_t> order(files.size());
+		std::vector<data_range> ranges;
+
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return (files[a]->offset < files[b]->offset); });
+
+		// compressed sizes are not known up front, assume stored chunks; files never overlap
+		for (size_t k = 0; k < order.size(); ++k) {
+			const file_data& file = *files[order[k]];
+			const size_t num_chunks = (file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0);
+
+			size_t end = file.offset + file.size;
+
+			if (file.compression_type != COMPRESSION_TYPE_NULL)
+				end += (num_chunks * (sizeof(uint32_t) + sizeof(hpi_chunk)));
+			if ((k + 1) < order.size())
+				end = std::min(end, std::max<size_t>(file.offset, files[order[k + 1]]->offset));
+
+			if (!ranges.empty() && file.offset <= (ranges.back().end + BATCH_READAHEAD_GAP)) {
+				ranges.back().end = std::max(ranges.back().end, end);
+			} else {
+				ranges.push_back({file.offset, end});
+			}
+		}
+
+		size_t next_range = 0;
+		size_t advised_end = 0;
+
+		for (const size_t i: order) {
+			const file_data& file = *files[i];
+			const size_t horizon = file.offset + BATCH_READAHEAD_SIZE;
+
+			// top up the readahead window once half of it has been consumed
+			while (next_range < ranges.size() && advised_end < (file.offset + BATCH_READAHEAD_SIZE / 2)) {
+				const data_range& range = ranges[next_range];
+				const size_t begin = std::max(range.begin, advised_end);
+
+				if (begin >= horizon)
+					break;
+
+				advise_willneed(begin, (advised_end = std::min(range.end, horizon)) - begin);
+
+				if (advised_end < range.end)
+					break;
+
+				next_range += 1;
+			}
+
+			extract(file, make_sink(i));
+		}
+	}
+
+	void hpi_archive::prefetch_file(const hpi_archive::file_data& file) const {
+		const size_t num_chunks = (file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0);
+
+		size_t size = file.size;
+
+		if (file.compression_type != COMPRESSION_TYPE_NULL)
+			size += (num_chunks * (sizeof(uint32_t) + sizeof(hpi_chunk)));
+
+		advise_willneed(file.offset, std::min(size, BATCH_READAHEAD_SIZE));
+	}
+
+	bool hpi_archive::read_chunk_headers(const hpi_archive::file_data& file, std::vector<hpi_archive::chunk_location>& chunks) const {
+		if (file.compression_type != COMPRESSION_TYPE_LZ77 && file.compression_type != COMPRESSION_TYPE_ZLIB)
+			return false;
+
+		const size_t num_chunks = (file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0);
+
+		// headers locate each other, the size table is not needed
+		size_t chunk_offset = file.offset + num_chunks * sizeof(uint32_t);
+
+		chunks.resize(num_chunks);
+
+		for (chunk_location& chunk: chunks) {
+			if (read_decrypt_buffer(chunk_offset, reinterpret_cast<char*>(&chunk.header), sizeof(hpi_chunk)) != sizeof(hpi_chunk))
+				return false;
+			if (chunk.header.magic != HPI_CHUNK_MAGIC_NUMBER)
+				return false;
+
+			chunk.data_offset = chunk_offset + sizeof(hpi_chunk);
+			chunk_offset = chunk.data_offset + chunk.header.compressed_size;
+		}
+
+		return true;
+	}
+
+	const char* hpi_archive::read_chunk_payload(const hpi_archive::chunk_location& chunk, size_t chunk_index, scratch_buffer& buffer) const {
+		const char* raw_data = read_raw_chunk_buffer(chunk.data_offset, chunk.header.compressed_size, buffer);
+
+		return (decode_chunk(chunk.header, raw_data, decrypt_key, chunk.data_offset, buffer, chunk_index));
+	}
+
+	size_t hpi_archive::extract_file_chunk(const hpi_archive::chunk_location& chunk, size_t chunk_index, char* out) const {
+		const scratch_lease lease(nullptr);
+
+		scratch_buffer& chunk_buffer = lease.get().chunk_buffer;
+
+		const char* raw_data = read_raw_chunk_buffer(chunk.data_offset, chunk.header.compressed_size, chunk_buffer);
+
+		return (extract_chunk(chunk.header, raw_data, decrypt_key, chunk.data_offset, chunk_buffer, zlib_context::get_thread_context(), out, chunk_index));
+	}
+
+	buffer_cache::buffer_ptr hpi_archive::extract_shared(const hpi_archive::file_data& file) const {
+		// files are identified by their data, entries sharing it also share the buffer
+		const uint64_t key = (static_cast<uint64_t>(file.offset) << 32) | file.size;
+
+		if (file_cache != nullptr) {
+			if (buffer_cache::buffer_ptr buffer = file_cache->find(key); buffer != nullptr)
+				return buffer;
+		}
+
+		std::shared_ptr<std::vector<char>> buffer = std::make_shared<std::vector<char>>(file.size);
+
+		extract(file, *buffer);
+
+		if (file_cache == nullptr)
+			return buffer;
+
+		return (file_cache->insert(key, std::move(buffer)));
+	}
+
+	void hpi_archive::set_file_cache(size_t byte_budget) {
+		if (byte_budget == 0) {
+			file_cache.reset();
+			return;
+		}
+
+		if (file_cache == nullptr) {
+			file_cache = std::make_unique<buffer_cache>(byte_budget);
+			return;
+		}
+
+		file_cache->set_budget(byte_budget);
+	}
+
+	bool hpi_archive::extract_compressed(const hpi_archive::file_data& file, std::vector<char>& buffer, extract_scratch* scratch) const {
+		const scratch_lease lease(scratch);
+		return (extract_compressed(file, buffer.data(), nullptr, lease.get()));
+	}
+
+	bool hpi_archive::extract_compressed(const hpi_archive::file_data& file, char* buffer, const extract_sink* sink, extract_scratch& scratch) const {
+		char error[256];
+
+		std::vector<uint32_t>& chunk_sizes = scratch.chunk_sizes;
+		scratch_buffer& chunk_buffer = scratch.chunk_buffer;
+		// holds one decompressed chunk at a time when streaming
+		scratch_buffer& sink_buffer = scratch.block_buffer;
+
+		// add one extra chunk if size is not a multiple of 64K
+		chunk_sizes.assign((file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0), 0);
+
+		zlib_context& zlib_ctx = zlib_context::get_thread_context();
+
+		size_t chunk_offset = file.offset;
+
+		read_decrypt_buffer(chunk_offset, reinterpret_cast<char*>(chunk_sizes.data()), chunk_sizes.size() * sizeof(uint32_t));
+		chunk_offset += (chunk_sizes.size() * sizeof(uint32_t));
+
+		if (chunk_pool != nullptr && chunk_sizes.size() > 1)
+			return (extract_chunks_parallel(file, chunk_offset, chunk_sizes.size(), buffer, sink, scratch));
+
+		size_t i = 0;
+		size_t buffer_offset = 0;
+
+		if (read_queue_depth != 0 && reader.is_open() && chunk_sizes.size() > 1)
+			extract_chunks_async(file, i, chunk_offset, buffer_offset, buffer, sink, scratch);
+
+		for (size_t n = chunk_sizes.size(); i < n; ++i) {
+			const hpi_chunk chunk_header = read_decrypt_raw_value<hpi_chunk>(chunk_offset);
+
+			if (chunk_header.magic != HPI_CHUNK_MAGIC_NUMBER) {
+				snprintf(error, sizeof(error) - 1, "[%s] invalid header magic-number %u for chunk %lu", __func__, chunk_header.magic, i);
+				throw hpi_exception(error);
+				return false;
+			}
+
+			if ((buffer_offset + chunk_header.decompressed_size) > file.size) {
+				snprintf(error, sizeof(error) - 1, "[%s] extracted file size %lu larger than expected size %u for chunk %lu", __func__, buffer_offset + chunk_header.decompressed_size, file.size, i);
+				throw hpi_exception(error);
+				return false;
+			}
+
+			const size_t data_offset = chunk_offset + sizeof(hpi_chunk);
+			const char* raw_data = read_raw_chunk_buffer(data_offset, chunk_header.compressed_size, chunk_buffer);
+
+			if (buffer != nullptr) {
+				extract_chunk(chunk_header, raw_data, decrypt_key, data_offset, chunk_buffer, zlib_ctx, buffer + buffer_offset, i);
+			} else {
+				resize_scratch_buffer(sink_buffer, chunk_header.decompressed_size);
+
+				extract_chunk(chunk_header, raw_data, decrypt_key, data_offset, chunk_buffer, zlib_ctx, sink_buffer.data(), i);
+				(*sink)(sink_buffer.data(), chunk_header.decompressed_size);
+			}
+
+			chunk_offset += (sizeof(hpi_chunk) + chunk_header.compressed_size);
+			buffer_offset += chunk_header.decompressed_size;
+		}
+
+		return true;
+	}
+
+	void hpi_archive::extract_chunks_async(const hpi_archive::file_data& file, size_t& chunk_index, size_t& chunk_offset, size_t& buffer_offset, char* buffer, const extract_sink* sink, extract_scratch& scratch) const {
+		const std::vector<uint32_t>& chunk_sizes = scratch.chunk_sizes;
+
+		// slot buffers have to outlive the reader, which waits for stray reads on destruction
+		std::vector<scratch_buffer>& read_buffers = scratch.read_buffers;
+		std::vector<uint64_t>& read_tickets = scratch.read_tickets;
+
+		scratch_buffer& chunk_buffer = scratch.chunk_buffer;
+		scratch_buffer& sink_buffer = scratch.block_buffer;
+
+		read_buffers.resize(std::max(read_buffers.size(), read_queue_depth));
+		read_tickets.resize(std::max(read_tickets.size(), read_queue_depth));
+
+		async_reader async(reader, read_queue_depth);
+
+		zlib_context& zlib_ctx = zlib_context::get_thread_context();
+
+		const size_t queue_depth = async.get_queue_depth();
+		const size_t num_chunks = chunk_sizes.size();
+
+		size_t num_readable = chunk_index;
+		size_t num_submitted = chunk_index;
+		size_t submit_offset = chunk_offset;
+
+		// never read ahead past an entry that can not describe a valid chunk
+		while (num_readable < num_chunks) {
+			if (chunk_sizes[num_readable] <= sizeof(hpi_chunk) || chunk_sizes[num_readable] > (sizeof(hpi_chunk) + HPI_CHUNK_SIZE * 2))
+				break;
+
+			num_readable += 1;
+		}
+
+		for (; chunk_index < num_readable; ++chunk_index) {
+			for (; num_submitted < num_readable && (num_submitted - chunk_index) < queue_depth; ++num_submitted) {
+				scratch_buffer& read_buffer = read_buffers[num_submitted % queue_depth];
+
+				resize_scratch_buffer(read_buffer, chunk_sizes[num_submitted]);
+				read_tickets[num_submitted % queue_depth] = async.submit(submit_offset, read_buffer.data(), read_buffer.size());
+
+				submit_offset += chunk_sizes[num_submitted];
+			}
+
+			const scratch_buffer& read_buffer = read_buffers[chunk_index % queue_depth];
+
+			if (async.wait(read_tickets[chunk_index % queue_depth]) != read_buffer.size())
+				break;
+
+			hpi_chunk chunk_header;
+			decrypt_buffer(decrypt_key, static_cast<uint8_t>(chunk_offset), read_buffer.data(), reinterpret_cast<char*>(&chunk_header), sizeof(hpi_chunk));
+
+			// the synchronous path reports the error (if any) on mismatch
+			if (chunk_header.magic != HPI_CHUNK_MAGIC_NUMBER || (sizeof(hpi_chunk) + chunk_header.compressed_size) != read_buffer.size())
+				break;
+			if ((buffer_offset + chunk_header.decompressed_size) > file.size)
+				break;
+
+			const size_t data_offset = chunk_offset + sizeof(hpi_chunk);
+			const char* raw_data = read_buffer.data() + sizeof(hpi_chunk);
+
+			if (buffer != nullptr) {
+				extract_chunk(chunk_header, raw_data, decrypt_key, data_offset, chunk_buffer, zlib_ctx, buffer + buffer_offset, chunk_index);
+			} else {
+				resize_scratch_buffer(sink_buffer, chunk_header.decompressed_size);
+
+				extract_chunk(chunk_header, raw_data, decrypt_key, data_offset, chunk_buffer, zlib_ctx, sink_buffer.data(), chunk_index);
+				(*sink)(sink_buffer.data(), chunk_header.decompressed_size);
+			}
+
+			chunk_offset += read_buffer.size();
+			buffer_offset += chunk_header.decompressed_size;
+		}
+	}
+
+	bool hpi_archive::extract_chunks_parallel(const hpi_archive::file_data& file, size_t chunk_offset, size_t num_chunks, char* buffer, const extract_sink* sink, extract_scratch& scratch) const {
+		typedef extract_scratch::chunk_info chunk_info;
+
+		std::vector<chunk_info>& chunks = scratch.chunks;
+		scratch_buffer& region_buffer = scratch.region_buffer;
+		scratch_buffer& batch_buffer = scratch.block_buffer;
+
+		chunks.resize(num_chunks);
+
+		char error[256];
+
+		// each header locates the next, so these have to be walked in order
+		for (size_t i = 0, buffer_offset = 0; i < num_chunks; ++i) {
+			const hpi_chunk chunk_header = read_decrypt_raw_value<hpi_chunk>(chunk_offset);
+
+			if (chunk_header.magic != HPI_CHUNK_MAGIC_NUMBER) {
+				snprintf(error, sizeof(error) - 1, "[%s] invalid header magic-number %u for chunk %lu", __func__, chunk_header.magic, i);
+				throw hpi_exception(error);
+				return false;
+			}
+
+			if ((buffer_offset + chunk_header.decompressed_size) > file.size) {
+				snprintf(error, sizeof(error) - 1, "[%s] extracted file size %lu larger than expected size %u for chunk %lu", __func__, buffer_offset + chunk_header.decompressed_size, file.size, i);
+				throw hpi_exception(error);
+				return false;
+			}
+
+			chunks[i] = {chunk_header, chunk_offset + sizeof(hpi_chunk), buffer_offset};
+
+			chunk_offset += (sizeof(hpi_chunk) + chunk_header.compressed_size);
+			buffer_offset += chunk_header.decompressed_size;
+		}
+
+		// when streaming, only as many chunks as there are threads are decompressed at once
+		const size_t batch_size = (buffer != nullptr)? num_chunks: (chunk_pool->size() + 1);
+
+		for (size_t batch_beg = 0; batch_beg < num_chunks; batch_beg += batch_size) {
+			const size_t batch_end = std::min(batch_beg + batch_size, num_chunks);
+
+			const chunk_info& first = chunks[batch_beg    ];
+			const chunk_info&  last = chunks[batch_end - 1];
+
+			const size_t region_beg = first.data_offset;
+			const size_t region_end = last.data_offset + last.header.compressed_size;
+			const char* region_data = nullptr;
+
+			char* batch_data = buffer;
+			size_t batch_offset = 0;
+
+			if (mapping.is_open() && region_end <= mapping.size()) {
+				region_data = mapping.data() + region_beg;
+
+				add_perf_counter(PERF_COUNTER_READS, 1);
+				add_perf_counter(PERF_COUNTER_READ_BYTES, region_end - region_beg);
+			} else {
+				// fetch all raw chunk data of the batch with one read
+				char* data = resize_scratch_buffer(region_buffer, region_end - region_beg);
+
+				std::fill(data + read_buffer(region_beg, data, region_buffer.size()), data + region_buffer.size(), 0);
+
+				region_data = region_buffer.data();
+			}
+
+			if (batch_data == nullptr) {
+				resize_scratch_buffer(batch_buffer, (last.buffer_offset + last.header.decompressed_size) - first.buffer_offset);
+
+				batch_data = batch_buffer.data();
+				batch_offset = first.buffer_offset;
+			}
+
+			chunk_pool->parallel_for(batch_end - batch_beg, [&](size_t k) {
+				// not the thread's extraction scratch, the calling thread runs these as well
+				static thread_local scratch_buffer chunk_buffer;
+
+				const chunk_info& info = chunks[batch_beg + k];
+				const hpi_chunk& header = info.header;
+
+				const char* raw_data = region_data + (info.data_offset - region_beg);
+
+				// output offsets are known up-front, so every chunk decompresses straight into its own slot
+				extract_chunk(header, raw_data, decrypt_key, info.data_offset, chunk_buffer, zlib_context::get_thread_context(), batch_data + (info.buffer_offset - batch_offset), batch_beg + k);
+			});
+
+			if (sink == nullptr)
+				continue;
+
+			for (size_t i = batch_beg; i < batch_end; ++i) {
+				(*sink)(batch_data + (chunks[i].buffer_offset - batch_offset), chunks[i].header.decompressed_size);
+			}
+		}
+
+		return true;
+	}
+
+
+	hpi_archive::verify_result hpi_archive::verify(const hpi_archive::file_data& file) const {
+		struct chunk_info {
+			hpi_chunk header;
+
+			size_t data_offset;
+			size_t chunk_index;
+		};
+
+		verify_result result;
+		char error[256];
+
+		add_perf_counter(PERF_COUNTER_FILES, 1);
+
+		// keeps the first error and the (unsorted) indices of corrupt chunks
+		const auto add_error = [&](const char* message, size_t first_chunk, size_t last_chunk) {
+			if (result.error.empty())
+				result.error = message;
+
+			for (size_t i = first_chunk; i < last_chunk; ++i) {
+				result.corrupt_chunks.push_back(i);
+			}
+		};
+
+		if (file.compression_type == COMPRESSION_TYPE_NULL) {
+			// stored data carries no checksum, it only has to be there in full
+			const scratch_lease lease(nullptr);
+
+			scratch_buffer& block_buffer = lease.get().block_buffer;
+
+			resize_scratch_buffer(block_buffer, std::min(file.size, HPI_CHUNK_SIZE));
+
+			for (size_t block_offset = 0; block_offset < file.size; block_offset += block_buffer.size()) {
+				const size_t block_size = std::min(block_buffer.size(), file.size - block_offset);
+
+				if (read_decrypt_buffer(file.offset + block_offset, block_buffer.data(), block_size) == block_size)
+					continue;
+
+				snprintf(error, sizeof(error) - 1, "[%s] file data truncated at offset %lu", __func__, file.offset + block_offset);
+				add_error(error, 0, 0);
+				break;
+			}
+
+			return result;
+		}
+
+		if (file.compression_type != COMPRESSION_TYPE_LZ77 && file.compression_type != COMPRESSION_TYPE_ZLIB) {
+			snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u", __func__, file.compression_type);
+			add_error(error, 0, 0);
+			return result;
+		}
+
+		std::vector<uint32_t> chunk_sizes((file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0), 0);
+		std::vector<chunk_info> chunks;
+
+		size_t chunk_offset = file.offset;
+		size_t decompressed_size = 0;
+
+		if (read_decrypt_buffer(chunk_offset, reinterpret_cast<char*>(chunk_sizes.data()), chunk_sizes.size() * sizeof(uint32_t)) != (chunk_sizes.size() * sizeof(uint32_t))) {
+			snprintf(error, sizeof(error) - 1, "[%s] chunk-size table truncated", __func__);
+			add_error(error, 0, chunk_sizes.size());
+			return result;
+		}
+
+		chunk_offset += (chunk_sizes.size() * sizeof(uint32_t));
+		chunks.reserve(chunk_sizes.size());
+
+		// headers are checked serially since each locates the next
+		for (size_t i = 0, n = chunk_sizes.size(); i < n; ++i) {
+			hpi_chunk chunk_header;
+
+			if (read_decrypt_buffer(chunk_offset, reinterpret_cast<char*>(&chunk_header), sizeof(hpi_chunk)) != sizeof(hpi_chunk)) {
+				snprintf(error, sizeof(error) - 1, "[%s] header truncated for chunk %lu", __func__, i);
+				add_error(error, i, n);
+				break;
+			}
+
+			const bool valid_magic = (chunk_header.magic == HPI_CHUNK_MAGIC_NUMBER);
+			// no chunk grows beyond twice its size, anything larger is a corrupt header
+			const bool valid_sizes = (chunk_header.decompressed_size <= HPI_CHUNK_SIZE && chunk_header.compressed_size <= (HPI_CHUNK_SIZE * 2));
+
+			if (valid_magic && valid_sizes) {
+				chunk_offset += (sizeof(hpi_chunk) + chunk_header.compressed_size);
+
+				if ((decompressed_size += chunk_header.decompressed_size) > file.size) {
+					snprintf(error, sizeof(error) - 1, "[%s] extracted file size %lu larger than expected size %u for chunk %lu", __func__, decompressed_size, file.size, i);
+					add_error(error, i, i + 1);
+					continue;
+				}
+
+				chunks.push_back({chunk_header, chunk_offset - chunk_header.compressed_size, i});
+				continue;
+			}
+
+			if (!valid_magic) {
+				snprintf(error, sizeof(error) - 1, "[%s] invalid header magic-number %u for chunk %lu", __func__, chunk_header.magic, i);
+			} else {
+				snprintf(error, sizeof(error) - 1, "[%s] invalid sizes (%u, %u) for chunk %lu", __func__, chunk_header.compressed_size, chunk_header.decompressed_size, i);
+			}
+
+			add_error(error, i, i + 1);
+
+			// the size table still locates the next chunk unless it is broken as well
+			if (chunk_sizes[i] < sizeof(hpi_chunk)) {
+				add_error(error, i + 1, n);
+				break;
+			}
+
+			chunk_offset += chunk_sizes[i];
+		}
+
+		if (result.is_valid() && decompressed_size != file.size) {
+			snprintf(error, sizeof(error) - 1, "[%s] extracted file size %lu smaller than expected size %u", __func__, decompressed_size, file.size);
+			add_error(error, 0, 0);
+		}
+
+		std::mutex result_mutex;
+
+		const auto verify_chunk_data = [&](size_t k) {
+			static thread_local scratch_buffer chunk_buffer;
+			static thread_local scratch_buffer out_buffer;
+
+			const chunk_info& info = chunks[k];
+
+			try {
+				const char* raw_data = read_raw_chunk_buffer(info.data_offset, info.header.compressed_size, chunk_buffer);
+
+				verify_chunk(info.header, raw_data, decrypt_key, info.data_offset, chunk_buffer, out_buffer, info.chunk_index);
+			} catch (const hpi_exception& e) {
+				const std::lock_guard<std::mutex> lock(result_mutex);
+
+				add_error(e.what(), info.chunk_index, info.chunk_index + 1);
+			}
+		};
+
+		if (chunk_pool != nullptr && chunks.size() > 1) {
+			chunk_pool->parallel_for(chunks.size(), verify_chunk_data);
+		} else {
+			for (size_t k = 0; k < chunks.size(); ++k) {
+				verify_chunk_data(k);
+			}
+		}
+
+		std::sort(result.corrupt_chunks.begin(), result.corrupt_chunks.end());
+		return result;
+	}
+
+
+	hpi_archive::extract_sink make_stream_sink(std::ostream& stream) {
+		return [&stream](const char* data, size_t size) { stream.write(data, size); };
+	}
+
+	hpi_archive::extract_sink make_fd_sink(int fd) {
+		return [fd](const char* data, size_t size) {
+			while (size > 0) {
+				const ssize_t num_bytes = write(fd, data, size);
+
+				if (num_bytes < 0) {
+					if (errno == EINTR)
+						continue;
+
+					char error[256];
+					snprintf(error, sizeof(error) - 1, "[make_fd_sink] write failed (%s)", strerror(errno));
+					throw hpi_exception(error);
+				}
+
+				data += num_bytes;
+				size -= num_bytes;
+			}
+		};
+	}
+
+
+	const hpi_archive::entry_list& hpi_archive::get_entries(const path_data& path) const {
+		if (materialized_paths == nullptr || &path == &root_path)
+			return path.entries;
+
+		// sub-directories live inside their parent's entry in the table
+		const size_t index = (reinterpret_cast<const char*>(&path) - reinterpret_cast<const char*>(entry_table.data())) / sizeof(arch_entry);
+
+		if (materialized_paths[index].load(std::memory_order_acquire) != 0)
+			return path.entries;
+
+		const std::lock_guard<std::mutex> lock(*materialize_mutex);
+
+		if (materialized_paths[index].load(std::memory_order_relaxed) == 0) {
+			const hpi_path_data* hpd = reinterpret_cast<const hpi_path_data*>(directory_buffer.data() + path.entries.size());
+			const    entry_list   el = const_cast<hpi_archive*>(this)->make_entry_list(*hpd, true);
+
+			const_cast<path_data&>(path).entries = el;
+			materialized_paths[index].store(1, std::memory_order_release);
+		}
+
+		return path.entries;
+	}
+
+
+	const hpi_archive::arch_entry* hpi_archive::find_entry(const path_data& path, std::string_view name) const {
+		const entry_list& entries = get_entries(path);
+
+		const auto beg = lookup_table.begin() + (entries.begin() - entry_table.data());
+		const auto end = beg + entries.size();
+
+		const auto pred = [&](uint32_t index, std::string_view n) { return (str_compare_nocase(entries[index].name, n) < 0); };
+		const auto iter = std::lower_bound(beg, end, name, pred);
+
+		if (iter == end || str_compare_nocase(entries[*iter].name, name) != 0)
+			return nullptr;
+
+		return &entries[*iter];
+	}
+
+
+	const hpi_archive::path_data* hpi_archive::find_parent_path(std::string_view path_str, std::string_view& name) const {
+		const path_data* path = &get_root_path();
+
+		// descend down the archive
+		for (size_t sep_pos = path_str.find('/'); sep_pos != std::string_view::npos; sep_pos = path_str.find('/')) {
+			const arch_entry* entry = find_entry(*path, path_str.substr(0, sep_pos));
+
+			if (entry == nullptr)
+				return nullptr;
+			if ((path = boost::get<path_data>(&entry->data)) == nullptr)
+				return nullptr;
+
+			path_str.remove_prefix(sep_pos + 1);
+		}
+
+		name = path_str;
+		return path;
+	}
+
+
+	#ifdef USE_STD_OPTIONAL
+	std::optional<std::reference_wrapper<const hpi_archive::file_data>>
+	#else
+	const hpi_archive::file_data*
+	#endif
+	hpi_archive::find_file(std::string_view path_str) const {
+		std::string_view name;
+
+		const path_data* path = find_parent_path(path_str, name);
+		const arch_entry* entry = (path != nullptr)? find_entry(*path, name): nullptr;
+		const file_data* file = (entry != nullptr)? boost::get<file_data>(&entry->data): nullptr;
+
+		#ifdef USE_STD_OPTIONAL
+		if (file == nullptr)
+			return std::nullopt;
+
+		return *file;
+		#else
+		return file;
+		#endif
+	}
+
+	#ifdef USE_STD_OPTIONAL
+	std::optional<std::reference_wrapper<const hpi_archive::path_data>>
+	#else
+	const hpi_archive::path_data*
+	#endif
+	hpi_archive::find_path(std::string_view path_str) const {
+		std::string_view name;
+
+		const path_data* path = find_parent_path(path_str, name);
+
+		// an empty last component (root or trailing slash) refers to the parent itself
+		if (path != nullptr && !name.empty()) {
+			const arch_entry* entry = find_entry(*path, name);
+
+			path = (entry != nullptr)? boost::get<path_data>(&entry->data): nullptr;
+		}
+
+		#ifdef USE_STD_OPTIONAL
+		if (path == nullptr)
+			return std::nullopt;
+
+		return *path;
+		#else
+		return path;
+		#endif
+	}
+
+
+	hpi_archive::path_index* hpi_archive::get_path_index() const {
+		if (file_path_index == nullptr)
+			return nullptr;
+
+		std::call_once(file_path_index->built, [this]() {
+			path_index& index = *file_path_index;
+			std::string parent_path;
+
+			add_path_index_files(index, get_root_entries(), parent_path);
+			str_fold_case(index.paths, index.folded_paths);
+
+			const auto folded_path = [&](const path_index::file_entry& f) { return (std::string_view(index.folded_paths).substr(f.path_offset, f.path_size)); };
+
+			// stable, so case-duplicate paths stay in directory order
+			std::stable_sort(index.files.begin(), index.files.end(), [&](const path_index::file_entry& a, const path_index::file_entry& b) { return (folded_path(a) < folded_path(b)); });
+		});
+
+		return (file_path_index.get());
+	}
+
+	void hpi_archive::add_path_index_files(path_index& index, const entry_list& entries, std::string& parent_path) const {
+		for (const arch_entry& entry: entries) {
+			if (const path_data* d = boost::get<path_data>(&entry.data); d != nullptr) {
+				const size_t parent_size = parent_path.size();
+
+				parent_path.append(entry.name);
+				parent_path.push_back('/');
+
+				add_path_index_files(index, get_entries(*d), parent_path);
+				parent_path.resize(parent_size);
+				continue;
+			}
+
+			const uint32_t path_offset = index.paths.size();
+
+			index.paths.append(parent_path);
+			index.paths.append(entry.name);
+			index.files.push_back({path_offset, static_cast<uint32_t>(index.paths.size() - path_offset), static_cast<uint32_t>(parent_path.size()), &boost::get<file_data>(entry.data)});
+		}
+	}
+
+	std::vector<hpi_archive::path_match> hpi_archive::find_indexed_files(path_index& index, std::string_view folded_prefix, std::string_view folded_pattern, bool match_names) const {
+		const std::string_view folded_paths = index.folded_paths;
+
+		// folded path or name of the i-th file in path order
+		const auto folded_key = [&](uint32_t i) {
+			const path_index::file_entry& f = index.files[i];
+			return (folded_paths.substr(f.path_offset + (f.name_offset * match_names), f.path_size - (f.name_offset * match_names)));
+		};
+
+		if (match_names) {
+			std::call_once(index.names_built, [&]() {
+				// names are sorted along with their positions, saving an indirection per comparison
+				std::vector<std::pair<std::string_view, uint32_t>> names(index.files.size());
+
+				for (size_t i = 0; i < index.files.size(); ++i) {
+					names[i] = {folded_key(i), static_cast<uint32_t>(i)};
+				}
+
+				std::sort(names.begin(), names.end());
+
+				index.name_order.resize(names.size());
+				std::transform(names.begin(), names.end(), index.name_order.begin(), [](const std::pair<std::string_view, uint32_t>& n) { return n.second; });
+			});
+		}
+
+		// file at position <k> of either order
+		const auto file_at = [&](size_t k) { return (match_names? index.name_order[k]: static_cast<uint32_t>(k)); };
+
+		// first position whose key is not less than (or, if <upper>, does not start with
+		// and is greater than) the prefix; keys sharing it form one contiguous range
+		const auto find_bound = [&](size_t lo, bool upper) {
+			for (size_t hi = index.files.size(); lo < hi; ) {
+				const size_t mid = lo + (hi - lo) / 2;
+				const std::string_view key = folded_key(file_at(mid));
+
+				if (upper? (key.substr(0, folded_prefix.size()) <= folded_prefix): (key < folded_prefix)) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+
+			return lo;
+		};
+
+		const size_t beg = find_bound(0, false);
+		const size_t end = find_bound(beg, true);
+
+		std::vector<uint32_t> file_indices;
+
+		for (size_t k = beg; k < end; ++k) {
+			if (folded_pattern.empty() || str_match_glob(folded_pattern, folded_key(file_at(k))))
+				file_indices.push_back(file_at(k));
+		}
+
+		// name matches come back in path order as well
+		if (match_names)
+			std::sort(file_indices.begin(), file_indices.end());
+
+		std::vector<path_match> matches;
+		matches.reserve(file_indices.size());
+
+		for (const uint32_t i: file_indices) {
+			matches.push_back({std::string_view(index.paths).substr(index.files[i].path_offset, index.files[i].path_size), index.files[i].file});
+		}
+
+		return matches;
+	}
+
+	std::vector<hpi_archive::path_match> hpi_archive::find_files_with_prefix(std::string_view prefix) const {
+		path_index* index = get_path_index();
+		std::string folded_prefix;
+
+		if (index == nullptr)
+			return {};
+
+		str_fold_case(prefix, folded_prefix);
+		return (find_indexed_files(*index, folded_prefix, {}, false));
+	}
+
+	std::vector<hpi_archive::path_match> hpi_archive::find_files_in_path(std::string_view path) const {
+		while (!path.empty() && path.back() == '/')
+			path.remove_suffix(1);
+
+		if (path.empty())
+			return (find_files_with_prefix({}));
+
+		// the separator keeps "unitpics" from also matching "unitpics2/"
+		return (find_files_with_prefix(std::string(path) + '/'));
+	}
+
+	std::vector<hpi_archive::path_match> hpi_archive::find_files_matching(std::string_view pattern) const {
+		path_index* index = get_path_index();
+		std::string folded_pattern;
+
+		if (index == nullptr || pattern.empty())
+			return {};
+
+		str_fold_case(pattern, folded_pattern);
+
+		const std::string_view folded_prefix = std::string_view(folded_pattern).substr(0, str_glob_prefix_size(folded_pattern));
+
+		// a pattern without wildcards is its own prefix, which only an exact match passes
+		return (find_indexed_files(*index, folded_prefix, folded_pattern, pattern.find('/') == std::string_view::npos));
+	}
+}
@@ -1,17 +1,29 @@
 #ifndef HAPINESS_ARCHIVE_UTIL_HDR
 #define HAPINESS_ARCHIVE_UTIL_HDR
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <istream>
+#include <memory>
+#include <mutex>
 #ifdef USE_STD_OPTIONAL
 #include <optional>
 #endif
+#include <string_view>
 #include <vector>
 
 #include <boost/variant.hpp>
 
+#include "cache_util.hpp"
+#include "index_util.hpp"
+#include "mmap_util.hpp"
+#include "scratch_util.hpp"
+
 
 namespace util {
+	class thread_pool;
+
 	// magic number at start of HPI header ("HAPI")
 	static constexpr unsigned int HPI_MAGIC_NUMBER = 0x49504148;
 
@@ -24,6 +36,9 @@ namespace util {
 	// magic number at start of HPI chunks ("SQSH")
 	static constexpr unsigned int HPI_CHUNK_MAGIC_NUMBER = 0x48535153;
 
+	// maximum decompressed size of an HPI chunk
+	static constexpr uint32_t HPI_CHUNK_SIZE = 65536;
+
 
 	struct hpi_exception: public std::runtime_error {
 	public:
@@ -112,50 +127,364 @@ namespace util {
 		struct file_data {
 			file_data() noexcept = default;
 
-			size_t offset = 0;
-			size_t size = 0;
+			uint32_t offset = 0;
+			uint32_t size = 0;
 
 			uint8_t compression_type = COMPRESSION_TYPE_NULL;
 		};
-		struct path_data {
-			std::vector<arch_entry> entries;
+
+		// view of the contiguous block of a directory's entries in the entry table
+		class entry_list {
+		public:
+			entry_list() = default;
+			entry_list(const arch_entry* first, uint32_t count): first_entry(first), num_entries(count) {}
+
+			const arch_entry* begin() const { return first_entry; }
+			const arch_entry* end() const { return (first_entry + num_entries); }
+
+			const arch_entry& operator [] (size_t i) const { return first_entry[i]; }
+
+			size_t size() const { return num_entries; }
+			bool empty() const { return (num_entries == 0); }
+
+		private:
+			const arch_entry* first_entry = nullptr;
+			uint32_t num_entries = 0;
+		};
+
+		class path_data {
+		private:
+			friend class hpi_archive;
+
+			// see get_entries; until a lazily opened directory is materialized, the first
+			// entry is null and the count holds the directory offset of its hpi_path_data
+			entry_list entries;
 		};
 		struct arch_entry {
-			std::string name;
+			// points into the decrypted directory block
+			std::string_view name;
 			boost::variant<file_data, path_data> data;
 		};
 
+		// receives consecutive pieces of a file's decompressed data
+		typedef std::function<void(const char* data, size_t size)> extract_sink;
+		// creates the sink for the i-th file of a batch
+		typedef std::function<extract_sink(size_t index)> batch_sink_factory;
+
+		// scratch storage of an extraction (chunk tables, raw and decompressed chunk data);
+		// buffers only ever grow, so a reused scratch stops allocating once it has seen
+		// the largest file
+		// note: not thread-safe, extractions without one use a per-thread scratch, which
+		// frees buffers larger than a few MB after every extraction
+		struct extract_scratch {
+			struct chunk_info {
+				hpi_chunk header;
+
+				size_t data_offset;
+				size_t buffer_offset;
+			};
+
+			std::vector<uint32_t> chunk_sizes;
+			std::vector<chunk_info> chunks;
+
+			// raw or decrypted chunk data
+			scratch_buffer chunk_buffer;
+			// one decompressed chunk or block of stored data
+			scratch_buffer block_buffer;
+			// raw data of several chunks read at once
+			scratch_buffer region_buffer;
+
+			// slots of the asynchronous read pipeline
+			std::vector<scratch_buffer> read_buffers;
+			std::vector<uint64_t> read_tickets;
+		};
+
+		struct path_match {
+			// full path as spelled in the archive, valid until the next open
+			std::string_view path;
+
+			const file_data* file = nullptr;
+		};
+
+		struct chunk_location {
+			hpi_chunk header;
+
+			// absolute offset of the chunk data, right past its header
+			size_t data_offset;
+		};
+
+		struct verify_result {
+			// first problem found, empty if the file is intact
+			std::string error;
+			// ascending indices of chunks that failed a check
+			std::vector<uint32_t> corrupt_chunks;
+
+			bool is_valid() const { return error.empty(); }
+		};
+
 	public:
 		hpi_archive() = default;
 		hpi_archive(std::istream* istream) { open(istream); }
+		hpi_archive(const std::string& file_path) { open(file_path); }
+
+		hpi_archive(const hpi_archive&) = delete;
+		hpi_archive(hpi_archive&&) = default;
+
+		hpi_archive& operator = (const hpi_archive&) = delete;
+		hpi_archive& operator = (hpi_archive&&) = default;
 
 		const path_data& get_root_path() const { return root_path; }
-		const std::vector<arch_entry>& get_root_entries() const { return root_path.entries; }
+		const entry_list& get_root_entries() const { return root_path.entries; }
+
+		// materializes the entries of <path> on first use if the archive was opened lazily
+		// note: thread-safe, <path> must belong to this archive
+		const entry_list& get_entries(const path_data& path) const;
 
+		// number of entries materialized so far
+		size_t get_num_entries() const { return entry_table.size(); }
+
+		// note: lookups are case-insensitive and do not allocate
 		#ifdef USE_STD_OPTIONAL
-		std::optional<std::reference_wrapper<const file_data>> find_file(const std::string& path) const;
-		std::optional<std::reference_wrapper<const path_data>> find_path(const std::string& path) const;
+		std::optional<std::reference_wrapper<const file_data>> find_file(std::string_view path) const;
+		std::optional<std::reference_wrapper<const path_data>> find_path(std::string_view path) const;
 		#else
-		const file_data* find_file(const std::string& path) const;
-		const path_data* find_path(const std::string& path) const;
+		const file_data* find_file(std::string_view path) const;
+		const path_data* find_path(std::string_view path) const;
 		#endif
 
+		// the queries below are answered from an index of all file paths sorted by their
+		// case-folded spelling, which the first query builds (materializing every directory
+		// of a lazily opened archive); results come in index order
+		// note: thread-safe
+		//
+		// files whose path starts with <prefix>, case-insensitively
+		std::vector<path_match> find_files_with_prefix(std::string_view prefix) const;
+		// files anywhere below directory <path>, all files if <path> is empty
+		std::vector<path_match> find_files_in_path(std::string_view path) const;
+		// files matching <pattern> (see str_match_glob), case-insensitively; patterns without
+		// a '/' are matched against file names only, so "*.TNT" finds maps at any depth, and
+		// others against full paths; either way only the range of the index sharing the
+		// pattern's literal prefix is scanned
+		std::vector<path_match> find_files_matching(std::string_view pattern) const;
+
+		// stream backend; caller owns the stream and keeps it open
+		// note: reads through a stream are serialized, prefer opening by path
 		bool open(std::istream* istream);
-		bool extract(const file_data& file, std::vector<char>& buffer) const;
-		bool extract_compressed(const file_data& file, std::vector<char>& buffer) const;
+		// memory-mapped backend, falls back to positional reads if the file can
+		// not be mapped (or mapping is disabled); returns false if the file can not
+		// be opened at all
+		bool open(const std::string& file_path);
+
+		bool is_mapped() const { return mapping.is_open(); }
+		// true if the directory was loaded from a sidecar index by the last open
+		bool is_indexed() const { return index_mapping.is_open(); }
+
+		// if set, opening by path keeps a sidecar index of the parsed directory and of each
+		// compressed file's chunk offsets in <dir>; a valid sidecar replaces reading and
+		// parsing the directory, a missing, stale or corrupt one is rebuilt
+		// note: building a sidecar parses every directory, lazy mode does not apply then
+		void set_index_dir(const std::string& dir) { index_dir = dir; }
+
+		// if set, subsequent opens only parse the root directory and parse every other
+		// directory the first time it is listed or searched
+		void set_lazy_directories(bool lazy) { lazy_directories = lazy; }
+
+		// if set, chunks of compressed files are decompressed in parallel on <pool>
+		void set_chunk_pool(thread_pool* pool) { chunk_pool = pool; }
+
+		// if unset, subsequent opens by path use positional reads instead of a mapping
+		void set_mapped_reads(bool mapped) { mapped_reads = mapped; }
+
+		// if non-zero, subsequent opens by path use positional reads instead of a mapping and
+		// serial extraction of compressed files keeps up to <depth> chunk reads in flight
+		// while earlier chunks are decompressed
+		void set_read_queue_depth(size_t depth) { read_queue_depth = depth; }
+
+		// note: extraction is thread-safe, any number of threads may extract concurrently
+		// note: <buffer> must be pre-sized to file.size
+		// note: <scratch> (if given) must not be shared between threads
+		bool extract(const file_data& file, std::vector<char>& buffer, extract_scratch* scratch = nullptr) const;
+		bool extract_compressed(const file_data& file, std::vector<char>& buffer, extract_scratch* scratch = nullptr) const;
+		// resizes <buffer> to file.size without zero-filling it; reusing the same buffer
+		// (and scratch) across calls makes extraction allocation-free
+		bool extract(const file_data& file, scratch_buffer& buffer, extract_scratch* scratch = nullptr) const;
+
+		// streams the file through <sink> in order, holding at most a chunk (or with a
+		// chunk pool set, one chunk per thread) of decompressed data at any time
+		bool extract(const file_data& file, const extract_sink& sink, extract_scratch* scratch = nullptr) const;
+		// writes the file at the current position of <fd> (which it advances); stored files
+		// are copied kernel-side if unencrypted and decrypted in one pass into the pre-sized
+		// target otherwise, anything else (or a non-regular target) goes through make_fd_sink
+		bool extract_to_file(const file_data& file, int fd) const;
+
+		// writes bytes [offset, offset + length) of the decompressed file to <out> and returns
+		// the number of bytes written (less than <length> if the range ends past the file);
+		// only the chunks overlapping the range are read and decompressed
+		size_t extract_range(const file_data& file, size_t offset, size_t length, char* out) const;
+
+		// extracts <files> in order of their data offsets so the archive is read front to
+		// back, asking the OS to read ahead over coalesced ranges of upcoming files
+		// note: <make_sink> is called once per file, right before it is extracted
+		void extract_batch(const std::vector<const file_data*>& files, const batch_sink_factory& make_sink) const;
+
+		// asks the OS to start reading the data of <file> in the background, at most one
+		// readahead window of it and sized as if stored (compressed sizes are not known yet)
+		// note: only a hint, streams get none
+		void prefetch_file(const file_data& file) const;
+
+		// runs every check extraction does (chunk magic, size and checksum) and also
+		// requires each chunk to decompress to exactly its stated size, but only ever
+		// decompresses into per-thread scratch buffers; problems are reported, not thrown
+		// note: uses the chunk pool if set, thread-safe like extract
+		verify_result verify(const file_data& file) const;
+
+		// reads the chunk headers of a compressed file in order, without reading or
+		// decompressing any chunk data; returns false for stored files and if a header
+		// is truncated or has an invalid magic-number
+		bool read_chunk_headers(const file_data& file, std::vector<chunk_location>& chunks) const;
+		// returns the decrypted, checksum-validated and decoded but still compressed data of
+		// a chunk located by read_chunk_headers, which either points into the mapping or
+		// into <buffer>
+		const char* read_chunk_payload(const chunk_location& chunk, size_t chunk_index, scratch_buffer& buffer) const;
+		// decompresses one chunk located by read_chunk_headers into <out>, which has to hold
+		// its header's decompressed_size bytes, and returns the number of bytes written
+		// note: runs every check extraction does, thread-safe like extract
+		size_t extract_file_chunk(const chunk_location& chunk, size_t chunk_index, char* out) const;
+
+		// returns the decompressed file as a shared read-only buffer, served from and
+		// added to the file cache if one is set (a hit neither copies nor decompresses)
+		buffer_cache::buffer_ptr extract_shared(const file_data& file) const;
+
+		// keeps up to <byte_budget> bytes of files returned by extract_shared, least
+		// recently used first out; zero removes the cache
+		// note: must not be called while other threads are extracting
+		void set_file_cache(size_t byte_budget);
+
+		buffer_cache::cache_stats get_file_cache_stats() const { return ((file_cache != nullptr)? file_cache->get_stats(): buffer_cache::cache_stats()); }
 
 	private:
-		hpi_archive::file_data make_file_data(const hpi_file_data& file) { return {file.data_offset, file.file_size, static_cast<uint8_t>(file.compression_type)}; }
-		hpi_archive::arch_entry make_arch_entry(const hpi_arch_entry& entry, const std::vector<char>& buffer);
-		hpi_archive::path_data make_path_data(const hpi_path_data& path, const std::vector<char>& buffer);
+		// see find_files_matching
+		struct path_index {
+			struct file_entry {
+				uint32_t path_offset;
+				uint32_t path_size;
+				// start of the file name within the path
+				uint32_t name_offset;
+
+				const file_data* file;
+			};
+
+			std::once_flag built;
+			std::once_flag names_built;
+
+			// full paths of all files, as spelled and case-folded (at the same offsets)
+			std::string paths;
+			std::string folded_paths;
+
+			// sorted by folded path
+			std::vector<file_entry> files;
+			// indices into <files>, sorted by folded file name; only built for the
+			// first name query since few callers need it
+			std::vector<uint32_t> name_order;
+		};
+
+	private:
+		static hpi_archive::file_data make_file_data(const hpi_file_data& file) { return {file.data_offset, file.file_size, static_cast<uint8_t>(file.compression_type)}; }
+		hpi_archive::arch_entry make_arch_entry(const hpi_arch_entry& entry) const;
+		// in lazy mode, the entry lists of sub-directories are left unmaterialized
+		hpi_archive::entry_list make_entry_list(const hpi_path_data& path, bool lazy);
+
+		bool open_archive(bool lazy);
+		bool open_indexed(const std::string& file_path);
+
+		bool load_index(const std::string& index_path, const std::string& archive_path, const archive_file_stamp& stamp);
+		bool save_index(const std::string& index_path, const std::string& archive_path, const archive_file_stamp& stamp) const;
+
+		// absolute offset of chunk <chunk_index> of <file> if the loaded index has it, 0 otherwise
+		size_t find_indexed_chunk(const file_data& file, size_t chunk_index) const;
+
+		const arch_entry* find_entry(const path_data& path, std::string_view name) const;
+		path_index* get_path_index() const;
+		void add_path_index_files(path_index& index, const entry_list& entries, std::string& parent_path) const;
+		// files in <index> whose folded path (or name) starts with <folded_prefix> and
+		// matches <folded_pattern> unless that is empty
+		std::vector<path_match> find_indexed_files(path_index& index, std::string_view folded_prefix, std::string_view folded_pattern, bool match_names) const;
+		const path_data* find_parent_path(std::string_view path, std::string_view& name) const;
+
+		void advise_willneed(size_t offset, size_t size) const;
+
+		size_t read_buffer(size_t offset, char* buffer, size_t size) const;
+		size_t read_decrypt_buffer(size_t offset, char* buffer, size_t size) const;
+
+		const char* read_raw_chunk_buffer(size_t offset, size_t size, scratch_buffer& chunk_buffer) const;
+
+		bool extract_buffer(const file_data& file, char* buffer, extract_scratch& scratch) const;
+
+		// writes into <buffer> if non-null, streams through <sink> otherwise
+		bool extract_compressed(const file_data& file, char* buffer, const extract_sink* sink, extract_scratch& scratch) const;
+		bool extract_chunks_parallel(const file_data& file, size_t chunk_offset, size_t num_chunks, char* buffer, const extract_sink* sink, extract_scratch& scratch) const;
+		// extracts chunks from <chunk_index> on with asynchronous reads located by the scratch's
+		// chunk sizes and advances all three positions; stops early at the first chunk that does
+		// not match its table entry, which the caller then handles synchronously
+		void extract_chunks_async(const file_data& file, size_t& chunk_index, size_t& chunk_offset, size_t& buffer_offset, char* buffer, const extract_sink* sink, extract_scratch& scratch) const;
+
+		template <typename T>
+		T read_decrypt_raw_value(size_t offset) const {
+			T val;
+			read_decrypt_buffer(offset, reinterpret_cast<char*>(&val), sizeof(T));
+			return val;
+		}
 
 	private:
 		std::istream* stream = nullptr;
+		std::unique_ptr<std::mutex> stream_mutex;
+
+		mapped_file mapping;
+		pread_file reader;
+
+		thread_pool* chunk_pool = nullptr;
+
+		size_t read_queue_depth = 0;
+
+		std::unique_ptr<buffer_cache> file_cache;
 
 		path_data root_path;
 
+		// decrypted directory block, entry names are views into it
+		std::vector<char> directory_buffer;
+
+		// entries of all directories; each directory's entries form one contiguous block
+		std::vector<arch_entry> entry_table;
+		// parallel to <entry_table>, holds each block's entry indices ordered by case-folded name
+		std::vector<uint32_t> lookup_table;
+
+		// reset by every open, filled in by the first path query
+		std::unique_ptr<path_index> file_path_index;
+
+		// lazy mode only; parallel to <entry_table>, set once a sub-directory's entries exist
+		std::unique_ptr<std::atomic<uint8_t>[]> materialized_paths;
+		std::unique_ptr<std::mutex> materialize_mutex;
+
+		// sidecar the directory was loaded from; entry names then point into it
+		mapped_file index_mapping;
+		std::string index_dir;
+
+		// sorted by data offset, both point into <index_mapping>
+		const hpi_index_chunk_file* chunk_files = nullptr;
+		const uint32_t* chunk_offsets = nullptr;
+
+		uint32_t num_chunk_files = 0;
+
+		bool lazy_directories = false;
+		bool mapped_reads = true;
+
 		uint8_t decrypt_key = 0;
 	};
+
+
+	hpi_archive::extract_sink make_stream_sink(std::ostream& stream);
+	// throws hpi_exception if writing to <fd> fails
+	hpi_archive::extract_sink make_fd_sink(int fd);
 }
 
 #endif
@@ -0,0 +1,807 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench_util.hpp"
+#include "archive_util.hpp"
+#include "crypt_util.hpp"
+#include "decompress_util.hpp"
+#include "thread_util.hpp"
+#include "writer_util.hpp"
+
+namespace util {
+	// note: only raw engine output is used, std distributions differ between standard libraries
+	typedef std::mt19937_64 gen_rng;
+
+	static uint32_t gen_uniform(gen_rng& rng, uint32_t lo, uint32_t hi) {
+		return (lo + (rng() % (uint64_t(hi) - lo + 1)));
+	}
+
+	static double gen_unit(gen_rng& rng) {
+		return ((rng() >> 11) * (1.0 / 9007199254740992.0));
+	}
+
+
+	// runs of noise between words from a small dictionary, roughly like game data
+	static void gen_file_content(gen_rng& rng, const std::vector<std::string>& words, char* out, size_t size) {
+		for (size_t pos = 0; pos < size; ) {
+			const uint64_t r = rng();
+
+			if ((r & 3) == 0) {
+				const size_t count = std::min<size_t>(1 + ((r >> 2) & 31), size - pos);
+
+				for (size_t i = 0; i < count; i += 8) {
+					const uint64_t noise = rng();
+					std::memcpy(out + pos + i, &noise, std::min<size_t>(8, count - i));
+				}
+
+				pos += count;
+			} else {
+				const std::string& word = words[(r >> 2) % words.size()];
+				const size_t count = std::min(word.size(), size - pos);
+
+				std::memcpy(out + pos, word.data(), count);
+				pos += count;
+			}
+		}
+	}
+
+
+	void generate_archive(const std::string& file_path, const archive_gen_params& params, thread_pool* pool) {
+		gen_rng rng(params.seed);
+
+		hpi_archive_writer writer;
+
+		std::vector<std::string> dir_paths = {""};
+		std::vector<uint32_t> dir_depths = {0};
+		std::vector<uint32_t> parent_dirs = {0};
+		std::vector<std::string> words(256);
+
+		for (uint32_t i = 1; i < std::max(1u, params.num_files / 16) && params.tree_depth > 0; ++i) {
+			const uint32_t parent = parent_dirs[gen_uniform(rng, 0, parent_dirs.size() - 1)];
+
+			dir_paths.push_back(dir_paths[parent] + "Dir" + std::to_string(i) + "/");
+			dir_depths.push_back(dir_depths[parent] + 1);
+			writer.add_path(dir_paths.back());
+
+			if (dir_depths.back() < params.tree_depth)
+				parent_dirs.push_back(i);
+		}
+
+		for (std::string& word: words) {
+			word.resize(gen_uniform(rng, 3, 24));
+
+			for (char& c: word) {
+				c = gen_uniform(rng, 'A', 'z');
+			}
+		}
+
+		const uint32_t mix_total = params.compression_mix[0] + params.compression_mix[1] + params.compression_mix[2];
+		const double min_log_size = std::log(params.min_file_size + 1.0);
+		const double max_log_size = std::log(std::max(params.min_file_size, params.max_file_size) + 1.0);
+
+		for (uint32_t i = 0; i < params.num_files; ++i) {
+			const uint32_t file_size = std::clamp<double>(std::exp(min_log_size + gen_unit(rng) * (max_log_size - min_log_size)) - 1.0, params.min_file_size, std::max(params.min_file_size, params.max_file_size));
+			const uint64_t file_seed = params.seed ^ ((i + 1) * 0x9E3779B97F4A7C15ull);
+
+			uint8_t compression_type = COMPRESSION_TYPE_NULL;
+
+			if (mix_total != 0) {
+				uint32_t r = gen_uniform(rng, 0, mix_total - 1);
+
+				while (r >= params.compression_mix[compression_type]) {
+					r -= params.compression_mix[compression_type++];
+				}
+			}
+
+			const std::string& dir_path = dir_paths[gen_uniform(rng, 0, dir_paths.size() - 1)];
+
+			// per-file generator, contents do not depend on the other files
+			writer.add_file(dir_path + "File" + std::to_string(i) + ".Dat", compression_type, [&words, file_size, file_seed](std::vector<char>& data) {
+				gen_rng file_rng(file_seed);
+
+				data.resize(file_size);
+				gen_file_content(file_rng, words, data.data(), file_size);
+			});
+		}
+
+		writer.set_header_key(params.header_key);
+		writer.set_encode_chunks(params.encode_chunks);
+		writer.set_chunk_pool(pool);
+
+		if (!writer.write(file_path)) {
+			char error[256];
+			snprintf(error, sizeof(error) - 1, "[%s] failed to open '%s' for writing", __func__, file_path.c_str());
+			throw hpi_exception(error);
+			return;
+		}
+	}
+
+
+	typedef std::pair<std::string, const hpi_archive::file_data*> bench_file;
+
+	static void collect_bench_files(const hpi_archive& archive, const hpi_archive::entry_list& entries, const std::string& parent, std::vector<bench_file>& files) {
+		for (const hpi_archive::arch_entry& entry: entries) {
+			const std::string path = parent + std::string(entry.name);
+
+			if (const hpi_archive::path_data* d = boost::get<hpi_archive::path_data>(&entry.data); d != nullptr) {
+				collect_bench_files(archive, archive.get_entries(*d), path + "/", files);
+			} else {
+				files.emplace_back(path, &boost::get<hpi_archive::file_data>(entry.data));
+			}
+		}
+	}
+
+	struct lz77_check_stats {
+		size_t num_chunks = 0;
+		size_t num_bytes = 0;
+
+		double time = 0.0;
+		double reference_time = 0.0;
+	};
+
+	// decompresses every LZ77 chunk of <files> with both decoders, which have to agree on
+	// the output (or on failing)
+	static lz77_check_stats check_lz77_decoder(const hpi_archive& archive, const std::vector<bench_file>& files) {
+		typedef std::chrono::steady_clock clock;
+		typedef std::chrono::duration<double> seconds;
+		typedef size_t (*lz77_decoder)(const char* in, size_t len, char* out, size_t max_bytes);
+
+		lz77_check_stats stats;
+
+		std::vector<hpi_archive::chunk_location> chunks;
+		scratch_buffer payload_buffer;
+		scratch_buffer out_buffers[2];
+
+		char error[256];
+
+		// a decoder that throws has written nothing
+		const auto run_decoder = [](lz77_decoder decoder, const hpi_chunk& header, const char* payload, scratch_buffer& out, double& time) {
+			char* out_data = resize_scratch_buffer(out, header.decompressed_size);
+			size_t num_bytes = std::numeric_limits<size_t>::max();
+
+			const clock::time_point t0 = clock::now();
+
+			try {
+				num_bytes = decoder(payload, header.compressed_size, out_data, header.decompressed_size);
+			} catch (const hpi_exception&) {
+			}
+
+			time += seconds(clock::now() - t0).count();
+			return num_bytes;
+		};
+
+		for (const bench_file& f: files) {
+			if (f.second->compression_type != COMPRESSION_TYPE_LZ77)
+				continue;
+
+			if (!archive.read_chunk_headers(*f.second, chunks)) {
+				snprintf(error, sizeof(error) - 1, "[%s] failed to read chunk headers of '%s'", __func__, f.first.c_str());
+				throw hpi_exception(error);
+				return stats;
+			}
+
+			for (size_t i = 0; i < chunks.size(); ++i) {
+				const hpi_chunk& header = chunks[i].header;
+
+				// incompressible chunks are stored even in LZ77 files
+				if (header.compression_type != COMPRESSION_TYPE_LZ77)
+					continue;
+
+				const char* payload = archive.read_chunk_payload(chunks[i], i, payload_buffer);
+
+				const size_t num_bytes = run_decoder(decompress_lz77, header, payload, out_buffers[0], stats.time);
+				const size_t num_reference_bytes = run_decoder(decompress_lz77_reference, header, payload, out_buffers[1], stats.reference_time);
+
+				if (num_bytes != num_reference_bytes || (num_bytes != std::numeric_limits<size_t>::max() && std::memcmp(out_buffers[0].data(), out_buffers[1].data(), num_bytes) != 0)) {
+					snprintf(error, sizeof(error) - 1, "[%s] LZ77 decoders disagree on chunk %lu of '%s'", __func__, i, f.first.c_str());
+					throw hpi_exception(error);
+					return stats;
+				}
+
+				stats.num_chunks += 1;
+				stats.num_bytes += header.decompressed_size;
+			}
+		}
+
+		return stats;
+	}
+
+	struct crypt_kernel_stats {
+		crypt_kernel_type type;
+
+		double decrypt_time = 0.0;
+		double decode_time = 0.0;
+	};
+
+	// checks every supported crypt kernel against decrypt_chunk_buffer_scalar (output bytes
+	// and checksum, in and out of place, over unaligned and odd sizes), then times each of
+	// them decrypting and decoding <num_bytes> in chunk-sized pieces
+	static std::vector<crypt_kernel_stats> check_crypt_kernels(size_t num_bytes) {
+		typedef std::chrono::steady_clock clock;
+		typedef std::chrono::duration<double> seconds;
+
+		static constexpr size_t MAX_CHECK_SIZE = 600;
+		static constexpr uint8_t CHECK_KEYS[] = {0x00, 0x7D, 0xFF};
+
+		const crypt_kernel_type active_kernel = get_crypt_kernel();
+
+		std::vector<crypt_kernel_stats> stats;
+		std::vector<char> src(HPI_CHUNK_SIZE + 16);
+		std::vector<char> dst(HPI_CHUNK_SIZE + 16);
+		std::vector<char> ref(HPI_CHUNK_SIZE + 16);
+
+		gen_rng rng(3);
+
+		for (char& c: src) {
+			c = rng();
+		}
+
+		char error[256];
+
+		for (const crypt_kernel_type type: {CRYPT_KERNEL_SCALAR, CRYPT_KERNEL_SSE2, CRYPT_KERNEL_AVX2}) {
+			if (!set_crypt_kernel(type))
+				continue;
+
+			for (const uint8_t key: CHECK_KEYS) {
+				for (size_t size = 0; size <= MAX_CHECK_SIZE; ++size) {
+					for (size_t align = 0; align < 4; ++align) {
+						for (uint32_t n = 0; n < 4; ++n) {
+							const bool decode = (n & 1) != 0;
+							const bool in_place = (n & 2) != 0;
+							const uint8_t seed = size * 7 + align;
+
+							const uint32_t ref_sum = decrypt_chunk_buffer_scalar(key, seed, src.data() + align, ref.data() + align, size, decode);
+
+							if (in_place)
+								std::copy(src.begin(), src.end(), dst.begin());
+
+							const uint32_t sum = decrypt_chunk_buffer(key, seed, (in_place? dst.data(): src.data()) + align, dst.data() + align, size, decode);
+
+							if (sum == ref_sum && std::equal(ref.data() + align, ref.data() + align + size, dst.data() + align))
+								continue;
+
+							set_crypt_kernel(active_kernel);
+							snprintf(error, sizeof(error) - 1, "[%s] %s kernel differs from scalar (key %u, size %lu, offset %lu, decode %d, in-place %d)", __func__, crypt_kernel_name(type), key, size, align, decode, in_place);
+							throw hpi_exception(error);
+							return stats;
+						}
+					}
+				}
+			}
+
+			crypt_kernel_stats kernel_stats;
+			kernel_stats.type = type;
+
+			for (uint32_t decode = 0; decode < 2; ++decode) {
+				const clock::time_point t0 = clock::now();
+
+				for (size_t n = 0; n < num_bytes; n += HPI_CHUNK_SIZE) {
+					// decryption as of encrypted archives, decoding as of encoded chunks
+					decrypt_chunk_buffer((decode != 0)? 0: 0x7D, n, src.data(), dst.data(), HPI_CHUNK_SIZE, decode != 0);
+				}
+
+				((decode != 0)? kernel_stats.decode_time: kernel_stats.decrypt_time) = seconds(clock::now() - t0).count();
+			}
+
+			stats.push_back(kernel_stats);
+		}
+
+		set_crypt_kernel(active_kernel);
+		return stats;
+	}
+
+	struct backend_stats {
+		const char* name;
+
+		double open_time = std::numeric_limits<double>::max();
+		double extract_time = 0.0;
+
+		size_t num_bytes = 0;
+		// chunks of compressed files, stored ones have none
+		size_t num_chunks = 0;
+	};
+
+	// drops the cached pages of <file_path> that nobody has mapped
+	static void evict_page_cache(const std::string& file_path) {
+		const int fd = open(file_path.c_str(), O_RDONLY);
+
+		if (fd == -1)
+			return;
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+
+	// opens <file_path> through each read backend (fastest of <num_opens>) and extracts
+	// every file once through it, from a cold page cache if <cold_cache> is set
+	static std::vector<backend_stats> compare_backends(const std::string& file_path, uint32_t num_opens, bool cold_cache) {
+		typedef std::chrono::steady_clock clock;
+		typedef std::chrono::duration<double> seconds;
+
+		std::vector<backend_stats> stats = {{"mmap"}, {"pread"}, {"pread_queued"}, {"stream"}};
+		std::vector<bench_file> files;
+
+		scratch_buffer buffer;
+		hpi_archive::extract_scratch scratch;
+
+		char error[256];
+
+		for (size_t i = 0; i < stats.size(); ++i) {
+			const bool streamed = (i == 3);
+			const bool queued = (i == 2);
+
+			// opened by path unless this is the stream pass
+			std::ifstream stream;
+			hpi_archive archive;
+
+			archive.set_mapped_reads(i == 0);
+			archive.set_read_queue_depth(queued? 4: 0);
+
+			for (uint32_t n = 0; n < std::max(1u, num_opens); ++n) {
+				const clock::time_point t0 = clock::now();
+
+				if (streamed) {
+					stream.close();
+					stream.open(file_path, std::ios::binary);
+				}
+
+				if (!(streamed? (stream.is_open() && archive.open(&stream)): archive.open(file_path))) {
+					snprintf(error, sizeof(error) - 1, "[%s] failed to open archive '%s' (%s)", __func__, file_path.c_str(), stats[i].name);
+					throw hpi_exception(error);
+					return stats;
+				}
+
+				stats[i].open_time = std::min(stats[i].open_time, seconds(clock::now() - t0).count());
+			}
+
+			files.clear();
+			collect_bench_files(archive, archive.get_root_entries(), "", files);
+
+			if (cold_cache)
+				evict_page_cache(file_path);
+
+			const clock::time_point t0 = clock::now();
+
+			for (size_t k = 0; k < files.size(); ++k) {
+				const hpi_archive::file_data& file = *files[k].second;
+
+				if (file.compression_type > COMPRESSION_TYPE_ZLIB)
+					continue;
+
+				// as the --extract-arch walker does with queued reads
+				if (queued && (k + 1) < files.size())
+					archive.prefetch_file(*files[k + 1].second);
+
+				archive.extract(file, buffer, &scratch);
+				stats[i].num_bytes += file.size;
+
+				if (file.compression_type != COMPRESSION_TYPE_NULL)
+					stats[i].num_chunks += (file.size / HPI_CHUNK_SIZE) + ((file.size % HPI_CHUNK_SIZE) != 0);
+			}
+
+			stats[i].extract_time = seconds(clock::now() - t0).count();
+		}
+
+		return stats;
+	}
+
+	void benchmark_archive(const std::string& file_path, const archive_bench_params& params, FILE* out) {
+		typedef std::chrono::steady_clock clock;
+		typedef std::chrono::duration<double> seconds;
+
+		hpi_archive archive;
+
+		char error[256];
+		double open_time = std::numeric_limits<double>::max();
+
+		for (uint32_t n = 0; n < std::max(1u, params.num_opens); ++n) {
+			hpi_archive a;
+
+			const clock::time_point t0 = clock::now();
+
+			if (!a.open(file_path)) {
+				snprintf(error, sizeof(error) - 1, "[%s] failed to open archive '%s'", __func__, file_path.c_str());
+				throw hpi_exception(error);
+				return;
+			}
+
+			open_time = std::min(open_time, seconds(clock::now() - t0).count());
+			archive = std::move(a);
+		}
+
+		std::vector<bench_file> files;
+		collect_bench_files(archive, archive.get_root_entries(), "", files);
+
+		// time-to-first-extract of the most deeply nested file, as seen by a one-shot tool
+		double lazy_open_time = std::numeric_limits<double>::max();
+		double first_extract_time[2] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+
+		if (!files.empty()) {
+			const auto depth_cmp = [](const bench_file& a, const bench_file& b) { return (std::count(a.first.begin(), a.first.end(), '/') < std::count(b.first.begin(), b.first.end(), '/')); };
+			const std::string& target = std::max_element(files.begin(), files.end(), depth_cmp)->first;
+
+			scratch_buffer buffer;
+
+			for (uint32_t n = 0; n < std::max(1u, params.num_opens); ++n) {
+				for (uint32_t lazy = 0; lazy < 2; ++lazy) {
+					hpi_archive a;
+					a.set_lazy_directories(lazy != 0);
+
+					const clock::time_point t0 = clock::now();
+
+					a.open(file_path);
+
+					const clock::time_point t1 = clock::now();
+					const auto file = a.find_file(target);
+
+					if (!file) {
+						snprintf(error, sizeof(error) - 1, "[%s] lookup of '%s' failed", __func__, target.c_str());
+						throw hpi_exception(error);
+						return;
+					}
+
+					const hpi_archive::file_data& file_data = *file;
+
+					a.extract(file_data, buffer);
+
+					if (lazy != 0)
+						lazy_open_time = std::min(lazy_open_time, seconds(t1 - t0).count());
+
+					first_extract_time[lazy] = std::min(first_extract_time[lazy], seconds(clock::now() - t0).count());
+				}
+			}
+		}
+
+		// lookups in a fixed pseudo-random order
+		std::vector<uint32_t> lookup_order(files.size());
+		std::iota(lookup_order.begin(), lookup_order.end(), 0);
+		std::shuffle(lookup_order.begin(), lookup_order.end(), gen_rng(1));
+
+		double lookup_time = 0.0;
+		size_t num_lookups = 0;
+
+		if (!files.empty()) {
+			const clock::time_point t0 = clock::now();
+
+			for (; num_lookups < params.num_lookups; ++num_lookups) {
+				if (archive.find_file(files[lookup_order[num_lookups % files.size()]].first))
+					continue;
+
+				snprintf(error, sizeof(error) - 1, "[%s] lookup of '%s' failed", __func__, files[lookup_order[num_lookups % files.size()]].first.c_str());
+				throw hpi_exception(error);
+				return;
+			}
+
+			lookup_time = seconds(clock::now() - t0).count();
+		}
+
+		// the first path query builds the index, later ones only touch their own range
+		double path_index_time = 0.0;
+		double path_query_time = 0.0;
+		size_t num_path_matches = 0;
+
+		if (!files.empty()) {
+			std::vector<std::string> query_paths(std::min<size_t>(params.num_path_queries, files.size()));
+
+			for (size_t n = 0; n < query_paths.size(); ++n) {
+				const std::string& path = files[lookup_order[n]].first;
+
+				query_paths[n] = path.substr(0, path.rfind('/') + 1);
+			}
+
+			const clock::time_point t0 = clock::now();
+
+			archive.find_files_in_path({});
+
+			const clock::time_point t1 = clock::now();
+
+			for (uint32_t n = 0; n < params.num_path_queries; ++n) {
+				num_path_matches += archive.find_files_in_path(query_paths[n % query_paths.size()]).size();
+			}
+
+			path_index_time = seconds(t1 - t0).count();
+			path_query_time = seconds(clock::now() - t1).count();
+		}
+
+		struct codec_stats {
+			size_t num_files = 0;
+			size_t num_bytes = 0;
+			double time = 0.0;
+		} stats[3];
+
+		// reused across files, as a tool extracting many files would
+		scratch_buffer buffer;
+		hpi_archive::extract_scratch scratch;
+
+		for (const bench_file& f: files) {
+			const hpi_archive::file_data& file = *f.second;
+
+			if (file.compression_type > COMPRESSION_TYPE_ZLIB)
+				continue;
+
+			const clock::time_point t0 = clock::now();
+
+			archive.extract(file, buffer, &scratch);
+
+			stats[file.compression_type].time += seconds(clock::now() - t0).count();
+			stats[file.compression_type].num_bytes += file.size;
+			stats[file.compression_type].num_files += 1;
+		}
+
+		const std::vector<backend_stats> backends = compare_backends(file_path, params.num_opens, params.cold_cache);
+		const lz77_check_stats lz77_stats = check_lz77_decoder(archive, files);
+		const std::vector<crypt_kernel_stats> crypt_stats = check_crypt_kernels(params.crypt_bytes);
+
+		// skewed (hot asset) read pattern through the file cache
+		double cache_time = 0.0;
+		size_t cache_bytes = 0;
+
+		if (params.cache_budget != 0 && !files.empty()) {
+			gen_rng rng(2);
+
+			archive.set_file_cache(params.cache_budget);
+
+			const clock::time_point t0 = clock::now();
+
+			for (uint32_t n = 0; n < params.num_cache_reads; ++n) {
+				const double u = gen_unit(rng);
+				const hpi_archive::file_data& file = *files[lookup_order[(u * u * u) * files.size()]].second;
+
+				if (file.compression_type > COMPRESSION_TYPE_ZLIB)
+					continue;
+
+				cache_bytes += archive.extract_shared(file)->size();
+			}
+
+			cache_time = seconds(clock::now() - t0).count();
+		}
+
+		std::string archive_name;
+
+		for (const char c: file_path) {
+			if (c == '"' || c == '\\')
+				archive_name += '\\';
+
+			archive_name += c;
+		}
+
+		fprintf(out, "{\"archive\": \"%s\", \"backend\": \"%s\", \"crypt_kernel\": \"%s\", \"zlib_backend\": \"%s\"", archive_name.c_str(), archive.is_mapped()? "mmap": "pread", crypt_kernel_name(get_crypt_kernel()), zlib_context::get_backend_name());
+		fprintf(out, ", \"entries\": %lu, \"files\": %lu, \"open_ms\": %.3f", archive.get_num_entries(), files.size(), open_time * 1000.0);
+
+		if (!files.empty())
+			fprintf(out, ", \"lazy_open_ms\": %.3f, \"first_extract_ms\": {\"eager\": %.3f, \"lazy\": %.3f}", lazy_open_time * 1000.0, first_extract_time[0] * 1000.0, first_extract_time[1] * 1000.0);
+
+		fprintf(out, ", \"lookups\": %lu, \"lookups_per_sec\": %.0f", num_lookups, (lookup_time > 0.0)? (num_lookups / lookup_time): 0.0);
+
+		if (!files.empty())
+			fprintf(out, ", \"path_index_ms\": %.3f, \"path_queries\": %u, \"path_query_us\": %.2f, \"path_matches\": %lu", path_index_time * 1000.0, params.num_path_queries, path_query_time * 1e6 / std::max(1u, params.num_path_queries), num_path_matches);
+		fprintf(out, ", \"extract\": {");
+
+		for (uint32_t i = 0; i < 3; ++i) {
+			const codec_stats& s = stats[i];
+			const char* name[] = {"null", "lz77", "zlib"};
+
+			fprintf(out, "%s\"%s\": {\"files\": %lu, \"bytes\": %lu, \"mb_per_sec\": %.1f}", (i == 0)? "": ", ", name[i], s.num_files, s.num_bytes, (s.time > 0.0)? (s.num_bytes / (s.time * 1024.0 * 1024.0)): 0.0);
+		}
+
+		fprintf(out, "}");
+		fprintf(out, ", \"lz77_check\": {\"chunks\": %lu, \"bytes\": %lu, \"mb_per_sec\": %.1f, \"reference_mb_per_sec\": %.1f}", lz77_stats.num_chunks, lz77_stats.num_bytes, (lz77_stats.time > 0.0)? (lz77_stats.num_bytes / (lz77_stats.time * 1024.0 * 1024.0)): 0.0, (lz77_stats.reference_time > 0.0)? (lz77_stats.num_bytes / (lz77_stats.reference_time * 1024.0 * 1024.0)): 0.0);
+
+		fprintf(out, ", \"cold_cache\": %s, \"backends\": {", params.cold_cache? "true": "false");
+
+		for (size_t i = 0; i < backends.size(); ++i) {
+			const backend_stats& b = backends[i];
+
+			fprintf(out, "%s\"%s\": {\"open_ms\": %.3f, \"bytes\": %lu, \"mb_per_sec\": %.1f, \"chunks\": %lu, \"chunks_per_sec\": %.0f}", (i == 0)? "": ", ", b.name, b.open_time * 1000.0, b.num_bytes, (b.extract_time > 0.0)? (b.num_bytes / (b.extract_time * 1024.0 * 1024.0)): 0.0, b.num_chunks, (b.extract_time > 0.0)? (b.num_chunks / b.extract_time): 0.0);
+		}
+
+		fprintf(out, "}");
+		fprintf(out, ", \"crypt_kernels\": {");
+
+		for (size_t i = 0; i < crypt_stats.size(); ++i) {
+			const crypt_kernel_stats& s = crypt_stats[i];
+
+			fprintf(out, "%s\"%s\": {\"decrypt_mb_per_sec\": %.1f, \"decode_mb_per_sec\": %.1f}", (i == 0)? "": ", ", crypt_kernel_name(s.type), (s.decrypt_time > 0.0)? (params.crypt_bytes / (s.decrypt_time * 1024.0 * 1024.0)): 0.0, (s.decode_time > 0.0)? (params.crypt_bytes / (s.decode_time * 1024.0 * 1024.0)): 0.0);
+		}
+
+		fprintf(out, "}");
+
+		if (params.cache_budget != 0) {
+			const buffer_cache::cache_stats cache_stats = archive.get_file_cache_stats();
+
+			fprintf(out, ", \"cache\": {\"budget\": %lu, \"reads\": %u, \"hits\": %lu, \"misses\": %lu, \"evictions\": %lu, \"mb_per_sec\": %.1f}", params.cache_budget, params.num_cache_reads, cache_stats.num_hits, cache_stats.num_misses, cache_stats.num_evictions, (cache_time > 0.0)? (cache_bytes / (cache_time * 1024.0 * 1024.0)): 0.0);
+		}
+
+		fprintf(out, "}\n");
+	}
+
+
+	// FNV-1a, can be fed piecewise
+	static constexpr uint64_t STRESS_HASH_SEED = 0xCBF29CE484222325ull;
+
+	static uint64_t hash_stress_data(uint64_t hash, const char* data, size_t size) {
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001B3ull;
+		}
+
+		return hash;
+	}
+
+	static bool open_stress_archive(hpi_archive& archive, std::ifstream& stream, const std::string& file_path, bool use_stream) {
+		if (!use_stream)
+			return (archive.open(file_path));
+
+		stream.open(file_path, std::ios::binary);
+		return (stream.is_open() && archive.open(&stream));
+	}
+
+	size_t stress_archive(const std::string& file_path, const archive_stress_params& params, FILE* out) {
+		typedef std::chrono::steady_clock clock;
+		typedef std::chrono::duration<double> seconds;
+
+		struct stress_pass {
+			const char* name;
+
+			size_t queue_depth;
+
+			bool mapped;
+			bool stream;
+			bool pooled;
+
+			size_t num_bytes = 0;
+			size_t num_failures = 0;
+
+			double time = 0.0;
+		};
+
+		std::vector<stress_pass> passes;
+
+		for (const bool pooled: {false, true}) {
+			passes.push_back({pooled? "mmap_pool": "mmap", 0, true, false, pooled});
+			passes.push_back({pooled? "pread_pool": "pread", 0, false, false, pooled});
+			passes.push_back({pooled? "pread_queued_pool": "pread_queued", 4, false, false, pooled});
+			passes.push_back({pooled? "stream_pool": "stream", 0, false, true, pooled});
+		}
+
+		std::vector<bench_file> ref_files;
+		std::vector<uint64_t> ref_hashes;
+
+		char error[256];
+
+		// reference contents, extracted serially
+		hpi_archive ref_archive;
+
+		if (!ref_archive.open(file_path)) {
+			snprintf(error, sizeof(error) - 1, "[%s] failed to open archive '%s'", __func__, file_path.c_str());
+			throw hpi_exception(error);
+			return 0;
+		}
+
+		collect_bench_files(ref_archive, ref_archive.get_root_entries(), "", ref_files);
+		ref_hashes.resize(ref_files.size());
+
+		{
+			scratch_buffer buffer;
+
+			for (size_t i = 0; i < ref_files.size(); ++i) {
+				ref_archive.extract(*ref_files[i].second, buffer);
+				ref_hashes[i] = hash_stress_data(STRESS_HASH_SEED, buffer.data(), buffer.size());
+			}
+		}
+
+		thread_pool chunk_pool(std::max(1u, params.num_pool_threads));
+
+		size_t num_failures = 0;
+
+		for (stress_pass& pass: passes) {
+			std::ifstream stream;
+			std::vector<bench_file> files;
+
+			hpi_archive archive;
+
+			archive.set_mapped_reads(pass.mapped);
+			archive.set_read_queue_depth(pass.queue_depth);
+
+			if (!open_stress_archive(archive, stream, file_path, pass.stream)) {
+				snprintf(error, sizeof(error) - 1, "[%s] failed to open archive '%s' (%s)", __func__, file_path.c_str(), pass.name);
+				throw hpi_exception(error);
+				return 0;
+			}
+
+			// same directory, same traversal order as the reference
+			collect_bench_files(archive, archive.get_root_entries(), "", files);
+
+			if (files.size() != ref_files.size()) {
+				snprintf(error, sizeof(error) - 1, "[%s] %s pass lists %lu files instead of %lu", __func__, pass.name, files.size(), ref_files.size());
+				throw hpi_exception(error);
+				return 0;
+			}
+
+			archive.set_chunk_pool(pass.pooled? &chunk_pool: nullptr);
+
+			std::atomic<size_t> num_pass_bytes = {0};
+			std::atomic<size_t> num_pass_failures = {0};
+			std::vector<std::thread> threads;
+
+			// every thread alternates between buffered and streamed extraction
+			const auto run_thread = [&](uint32_t thread_index) {
+				gen_rng rng(thread_index + 1);
+				scratch_buffer buffer;
+
+				size_t num_bytes = 0;
+				size_t num_thread_failures = 0;
+
+				for (uint32_t n = 0; n < params.num_extracts && !files.empty(); ++n) {
+					const size_t i = rng() % files.size();
+
+					uint64_t hash = STRESS_HASH_SEED;
+					bool extracted = false;
+
+					try {
+						if ((n & 1) == 0) {
+							extracted = archive.extract(*files[i].second, buffer);
+							hash = hash_stress_data(hash, buffer.data(), buffer.size());
+						} else {
+							extracted = archive.extract(*files[i].second, [&](const char* data, size_t size) { hash = hash_stress_data(hash, data, size); });
+						}
+					} catch (const hpi_exception&) {
+						extracted = false;
+					}
+
+					num_bytes += files[i].second->size;
+					num_thread_failures += (!extracted || hash != ref_hashes[i]);
+				}
+
+				num_pass_bytes += num_bytes;
+				num_pass_failures += num_thread_failures;
+			};
+
+			const clock::time_point t0 = clock::now();
+
+			for (uint32_t t = 0; t < std::max(1u, params.num_threads); ++t) {
+				threads.emplace_back(run_thread, t);
+			}
+			for (std::thread& t: threads) {
+				t.join();
+			}
+
+			pass.time = seconds(clock::now() - t0).count();
+			pass.num_bytes = num_pass_bytes;
+			pass.num_failures = num_pass_failures;
+
+			num_failures += pass.num_failures;
+		}
+
+		std::string archive_name;
+
+		for (const char c: file_path) {
+			if (c == '"' || c == '\\')
+				archive_name += '\\';
+
+			archive_name += c;
+		}
+
+		fprintf(out, "{\"archive\": \"%s\", \"files\": %lu, \"threads\": %u, \"extracts_per_thread\": %u, \"pool_threads\": %u, \"passes\": {", archive_name.c_str(), ref_files.size(), std::max(1u, params.num_threads), params.num_extracts, std::max(1u, params.num_pool_threads));
+
+		for (size_t i = 0; i < passes.size(); ++i) {
+			const stress_pass& p = passes[i];
+
+			fprintf(out, "%s\"%s\": {\"failures\": %lu, \"bytes\": %lu, \"seconds\": %.3f}", (i == 0)? "": ", ", p.name, p.num_failures, p.num_bytes, p.time);
+		}
+
+		fprintf(out, "}, \"failures\": %lu}\n", num_failures);
+		return num_failures;
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef HAPINESS_BENCH_UTIL_HDR
+#define HAPINESS_BENCH_UTIL_HDR
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace util {
+	class thread_pool;
+
+	struct archive_gen_params {
+		// same seed and parameters always produce the same archive
+		uint64_t seed = 1;
+
+		uint32_t num_files = 1000;
+		// directories get 16 files on average and nest at most this deep
+		uint32_t tree_depth = 3;
+
+		// file sizes are log-uniformly distributed over [min_file_size, max_file_size]
+		uint32_t min_file_size = 0;
+		uint32_t max_file_size = 256 * 1024;
+
+		// relative weights of NULL, LZ77 and ZLIB compressed files
+		uint32_t compression_mix[3] = {1, 1, 1};
+
+		// non-zero encrypts directory and file data
+		uint32_t header_key = 0;
+		// encodes the payload of every chunk
+		bool encode_chunks = false;
+	};
+
+	struct archive_bench_params {
+		// open() is timed this many times, the fastest run is reported
+		uint32_t num_opens = 10;
+		uint32_t num_lookups = 1000000;
+		// find_files_in_path on the parent directories of the looked up files
+		uint32_t num_path_queries = 10000;
+
+		// bytes each crypt kernel decrypts (and decodes) when timed
+		size_t crypt_bytes = 256 << 20;
+
+		// evicts the archive from the page cache before each backend's extraction pass, so
+		// reads have to go to the disk (as far as the OS honours the hint)
+		bool cold_cache = false;
+
+		// non-zero adds a pass of skewed extract_shared reads through a file cache of this size
+		size_t cache_budget = 0;
+		uint32_t num_cache_reads = 100000;
+	};
+
+	struct archive_stress_params {
+		// extracting threads sharing one archive, each extracts this many random files per pass
+		uint32_t num_threads = 8;
+		uint32_t num_extracts = 200;
+		// size of the chunk pool in passes that use one
+		uint32_t num_pool_threads = 4;
+	};
+
+
+	// writes a synthetic archive with compressible pseudo-random file contents
+	// note: if <pool> is set, files are generated and compressed in parallel on it
+	void generate_archive(const std::string& file_path, const archive_gen_params& params, thread_pool* pool = nullptr);
+
+	// times open, find_file and extract (per compression type) on <file_path>, compares
+	// open time and extraction throughput (MB/s and chunks/s) of the mmap, pread, pread
+	// with queued reads (and the next file prefetched) and stream backends, checks decompress_lz77 against decompress_lz77_reference on every
+	// LZ77 chunk and each supported crypt kernel against the scalar one (throwing at the
+	// first disagreement), times the kernels and writes the results as a single JSON
+	// object to <out>
+	void benchmark_archive(const std::string& file_path, const archive_bench_params& params, FILE* out);
+
+	// extracts random files of <file_path> from many threads sharing one archive, once per
+	// backend (mmap, pread, pread with queued reads, stream) with and without a chunk pool,
+	// compares every result against a serial extraction and writes the results as a single
+	// JSON object to <out>; returns the number of extractions that failed or differed
+	size_t stress_archive(const std::string& file_path, const archive_stress_params& params, FILE* out);
+}
+
+#endif
+
@@ -0,0 +1,83 @@
+#include "cache_util.hpp"
+
+namespace util {
+	buffer_cache::buffer_ptr buffer_cache::find(uint64_t key) {
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+		const auto iter = buffer_index.find(key);
+
+		if (iter == buffer_index.end()) {
+			stats.num_misses += 1;
+			return nullptr;
+		}
+
+		stats.num_hits += 1;
+
+		buffers.splice(buffers.begin(), buffers, iter->second);
+		return iter->second->second;
+	}
+
+	buffer_cache::buffer_ptr buffer_cache::insert(uint64_t key, buffer_ptr buffer) {
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+
+		if (const auto iter = buffer_index.find(key); iter != buffer_index.end()) {
+			buffers.splice(buffers.begin(), buffers, iter->second);
+			return iter->second->second;
+		}
+
+		if (buffer->size() > byte_budget)
+			return buffer;
+
+		evict(buffer->size());
+
+		buffers.emplace_front(key, buffer);
+		buffer_index.emplace(key, buffers.begin());
+
+		stats.num_bytes += buffer->size();
+		stats.num_buffers += 1;
+		return buffer;
+	}
+
+
+	void buffer_cache::clear() {
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+
+		buffers.clear();
+		buffer_index.clear();
+
+		stats.num_bytes = 0;
+		stats.num_buffers = 0;
+	}
+
+	void buffer_cache::set_budget(size_t budget) {
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+
+		byte_budget = budget;
+		evict(0);
+	}
+
+	size_t buffer_cache::get_budget() const {
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+		return byte_budget;
+	}
+
+	buffer_cache::cache_stats buffer_cache::get_stats() const {
+		const std::lock_guard<std::mutex> lock(cache_mutex);
+		return stats;
+	}
+
+
+	void buffer_cache::evict(size_t num_bytes) {
+		// note: evicted buffers stay alive for as long as someone holds them
+		while (!buffers.empty() && (stats.num_bytes + num_bytes) > byte_budget) {
+			const lru_list::value_type& lru = buffers.back();
+
+			stats.num_bytes -= lru.second->size();
+			stats.num_buffers -= 1;
+			stats.num_evictions += 1;
+
+			buffer_index.erase(lru.first);
+			buffers.pop_back();
+		}
+	}
+}
+
@@ -0,0 +1,65 @@
+#ifndef HAPINESS_CACHE_UTIL_HDR
+#define HAPINESS_CACHE_UTIL_HDR
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace util {
+	// thread-safe LRU cache of immutable buffers, bounded by their total size in bytes
+	class buffer_cache {
+	public:
+		typedef std::shared_ptr<const std::vector<char>> buffer_ptr;
+
+		struct cache_stats {
+			uint64_t num_hits = 0;
+			uint64_t num_misses = 0;
+			uint64_t num_evictions = 0;
+
+			size_t num_bytes = 0;
+			size_t num_buffers = 0;
+		};
+
+	public:
+		buffer_cache(size_t budget): byte_budget(budget) {}
+		buffer_cache(const buffer_cache&) = delete;
+
+		buffer_cache& operator = (const buffer_cache&) = delete;
+
+		// returns null and counts a miss if <key> is not cached
+		buffer_ptr find(uint64_t key);
+		// returns the already cached buffer if <key> was inserted by another thread in the
+		// meantime; buffers larger than the budget are passed through without being cached
+		buffer_ptr insert(uint64_t key, buffer_ptr buffer);
+
+		void clear();
+		void set_budget(size_t budget);
+
+		size_t get_budget() const;
+		cache_stats get_stats() const;
+
+	private:
+		// drops least recently used buffers until <num_bytes> fits the budget
+		void evict(size_t num_bytes);
+
+	private:
+		typedef std::list<std::pair<uint64_t, buffer_ptr>> lru_list;
+
+		// most recently used first
+		lru_list buffers;
+		std::unordered_map<uint64_t, lru_list::iterator> buffer_index;
+
+		mutable std::mutex cache_mutex;
+
+		size_t byte_budget = 0;
+
+		cache_stats stats;
+	};
+}
+
+#endif
+
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#else
+#include <zlib.h>
+#endif
+
+#include "compress_util.hpp"
+#include "archive_util.hpp"
+
+namespace util {
+	static constexpr uint32_t LZ77_WINDOW_SIZE = 4096;
+	static constexpr uint32_t LZ77_MIN_MATCH = 3;
+	static constexpr uint32_t LZ77_MAX_MATCH = 17;
+	static constexpr uint32_t LZ77_HASH_BITS = 13;
+	static constexpr uint32_t LZ77_MAX_CHAIN = 32;
+
+	static uint32_t lz77_hash(const uint8_t* p) {
+		return (((p[0] << 16) | (p[1] << 8) | p[2]) * 2654435761u) >> (32 - LZ77_HASH_BITS);
+	}
+
+	// greedy hash-chain matcher producing the stream decompress_lz77 reads; a match source
+	// byte s lives in window slot (s + 1) & 0xFFF, which may not be 0 (the terminator)
+	size_t compress_lz77(const char* in, size_t len, char* out) {
+		const uint8_t* src = reinterpret_cast<const uint8_t*>(in);
+
+		std::vector<int32_t> hash_head(1 << LZ77_HASH_BITS, -1);
+		std::vector<int32_t> hash_prev(LZ77_WINDOW_SIZE, -1);
+
+		size_t in_pos = 0;
+		size_t out_pos = 0;
+		size_t tag_pos = 0;
+		uint32_t num_items = 8;
+
+		// starts a new tag byte every 8 items, returns the bit for the next item
+		const auto next_item_bit = [&]() {
+			if (num_items == 8) {
+				tag_pos = out_pos++;
+				num_items = 0;
+				out[tag_pos] = 0;
+			}
+
+			return (1 << (num_items++));
+		};
+		const auto insert_hash = [&](size_t pos) {
+			if ((pos + LZ77_MIN_MATCH) > len)
+				return;
+
+			const uint32_t hash = lz77_hash(src + pos);
+
+			hash_prev[pos & (LZ77_WINDOW_SIZE - 1)] = hash_head[hash];
+			hash_head[hash] = pos;
+		};
+		const auto write_match = [&](uint32_t offset, uint32_t count) {
+			const uint16_t packed_data = (offset << 4) | (count - 2);
+
+			out[tag_pos] |= next_item_bit();
+			out[out_pos++] = packed_data & 0xFF;
+			out[out_pos++] = packed_data >> 8;
+		};
+
+		while (in_pos < len) {
+			const uint32_t max_count = std::min<size_t>(LZ77_MAX_MATCH, len - in_pos);
+
+			uint32_t best_count = 0;
+			uint32_t best_offset = 0;
+
+			if (max_count >= LZ77_MIN_MATCH) {
+				int32_t cand = hash_head[lz77_hash(src + in_pos)];
+
+				for (uint32_t n = 0; n < LZ77_MAX_CHAIN && cand >= 0 && (in_pos - cand) < LZ77_WINDOW_SIZE; ++n) {
+					const uint32_t offset = (cand + 1) & (LZ77_WINDOW_SIZE - 1);
+
+					uint32_t count = 0;
+
+					while (count < max_count && src[cand + count] == src[in_pos + count]) {
+						count++;
+					}
+
+					if (offset != 0 && count > best_count) {
+						best_count = count;
+						best_offset = offset;
+
+						if (count == max_count)
+							break;
+					}
+
+					cand = hash_prev[cand & (LZ77_WINDOW_SIZE - 1)];
+				}
+			}
+
+			if (best_count < LZ77_MIN_MATCH) {
+				next_item_bit();
+				out[out_pos++] = src[in_pos];
+
+				insert_hash(in_pos++);
+				continue;
+			}
+
+			write_match(best_offset, best_count);
+
+			for (uint32_t i = 0; i < best_count; ++i) {
+				insert_hash(in_pos++);
+			}
+		}
+
+		write_match(0, 2);
+		return out_pos;
+	}
+
+
+	#ifdef USE_LIBDEFLATE
+	size_t compress_zlib_bound(size_t len) {
+		return (libdeflate_zlib_compress_bound(nullptr, len));
+	}
+
+	size_t compress_zlib(const char* in, size_t len, char* out, size_t max_bytes, int level) {
+		libdeflate_compressor* compressor = libdeflate_alloc_compressor(level);
+
+		char error[256];
+
+		if (compressor == nullptr) {
+			snprintf(error, sizeof(error) - 1, "[%s] failed to allocate compressor", __func__);
+			throw hpi_exception(error);
+			return 0;
+		}
+
+		const size_t out_size = libdeflate_zlib_compress(compressor, in, len, out, max_bytes);
+
+		libdeflate_free_compressor(compressor);
+
+		if (out_size == 0) {
+			snprintf(error, sizeof(error) - 1, "[%s] output buffer too small (%lu bytes)", __func__, max_bytes);
+			throw hpi_exception(error);
+			return 0;
+		}
+
+		return out_size;
+	}
+	#else
+	size_t compress_zlib_bound(size_t len) {
+		return (compressBound(len));
+	}
+
+	size_t compress_zlib(const char* in, size_t len, char* out, size_t max_bytes, int level) {
+		uLongf out_size = max_bytes;
+
+		char error[256];
+
+		if (const int ret = compress2(reinterpret_cast<Bytef*>(out), &out_size, reinterpret_cast<const Bytef*>(in), len, level); ret != Z_OK) {
+			snprintf(error, sizeof(error) - 1, "[%s] compression failed (%d)", __func__, ret);
+			throw hpi_exception(error);
+			return 0;
+		}
+
+		return out_size;
+	}
+	#endif
+}
+
@@ -0,0 +1,17 @@
+#ifndef HAPINESS_COMPRESS_UTIL_HDR
+#define HAPINESS_COMPRESS_UTIL_HDR
+
+#include <cstddef>
+
+namespace util {
+	// worst case (all literals) size of compress_lz77 output: one tag per 8 items plus the terminator
+	inline size_t compress_lz77_bound(size_t len) { return (len + (len / 8) + 1 + 2); }
+	size_t compress_zlib_bound(size_t len);
+
+	// both return the number of bytes written to <out>, which must hold at least the bound
+	size_t compress_lz77(const char* in, size_t len, char* out);
+	size_t compress_zlib(const char* in, size_t len, char* out, size_t max_bytes, int level = 6);
+}
+
+#endif
+
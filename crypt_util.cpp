@@ -0,0 +1,248 @@
+#include <atomic>
+#include <cstring>
+
+#if (defined(__x86_64__))
+#define HAPINESS_CRYPT_X86
+#include <immintrin.h>
+#endif
+
+#include "crypt_util.hpp"
+
+namespace util {
+	typedef uint32_t (*crypt_kernel_func)(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size, bool decode);
+
+
+	template<bool decrypt, bool decode>
+	static uint32_t crypt_kernel_scalar(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size, size_t i, uint32_t sum) {
+		for (; i < size; ++i) {
+			const uint8_t dec_pos = seed + static_cast<uint8_t>(i);
+			const uint8_t enc_pos = static_cast<uint8_t>(i);
+
+			uint8_t byte = src[i];
+
+			if (decrypt)
+				byte ^= (dec_pos ^ key);
+
+			sum += byte;
+
+			if (decode)
+				byte = (byte - enc_pos) ^ enc_pos;
+
+			dst[i] = byte;
+		}
+
+		return sum;
+	}
+
+	template<bool decrypt, bool decode>
+	static uint32_t crypt_kernel_scalar(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size) {
+		return (crypt_kernel_scalar<decrypt, decode>(key, seed, src, dst, size, 0, 0));
+	}
+
+
+	#ifdef HAPINESS_CRYPT_X86
+	// both position patterns (seed + i and i) advance by one per byte and wrap every 256
+	// bytes, so each lane just carries its own position and all lanes step by the width
+	template<bool decrypt, bool decode>
+	static uint32_t crypt_kernel_sse2(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size) {
+		const __m128i lane_pos = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m128i step_pos = _mm_set1_epi8(16);
+		const __m128i key_bits = _mm_set1_epi8(key);
+		const __m128i zero_vec = _mm_setzero_si128();
+
+		__m128i enc_pos = lane_pos;
+		__m128i dec_pos = _mm_add_epi8(lane_pos, _mm_set1_epi8(seed));
+		__m128i sum_vec = zero_vec;
+
+		size_t i = 0;
+
+		for (; (i + 16) <= size; i += 16) {
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+			if (decrypt)
+				bytes = _mm_xor_si128(bytes, _mm_xor_si128(dec_pos, key_bits));
+
+			// horizontal byte sums into the two 64-bit lanes
+			sum_vec = _mm_add_epi64(sum_vec, _mm_sad_epu8(bytes, zero_vec));
+
+			if (decode)
+				bytes = _mm_xor_si128(_mm_sub_epi8(bytes, enc_pos), enc_pos);
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), bytes);
+
+			enc_pos = _mm_add_epi8(enc_pos, step_pos);
+			dec_pos = _mm_add_epi8(dec_pos, step_pos);
+		}
+
+		const uint32_t sum = _mm_cvtsi128_si32(sum_vec) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum_vec, sum_vec));
+		return (crypt_kernel_scalar<decrypt, decode>(key, seed, src, dst, size, i, sum));
+	}
+
+	template<bool decrypt, bool decode>
+	__attribute__((target("avx2")))
+	static uint32_t crypt_kernel_avx2(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size) {
+		const __m256i lane_pos = _mm256_setr_epi8(
+			 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+			16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
+		);
+		const __m256i step_pos = _mm256_set1_epi8(32);
+		const __m256i key_bits = _mm256_set1_epi8(key);
+		const __m256i zero_vec = _mm256_setzero_si256();
+
+		__m256i enc_pos = lane_pos;
+		__m256i dec_pos = _mm256_add_epi8(lane_pos, _mm256_set1_epi8(seed));
+		__m256i sum_vec = zero_vec;
+
+		size_t i = 0;
+
+		for (; (i + 32) <= size; i += 32) {
+			__m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+			if (decrypt)
+				bytes = _mm256_xor_si256(bytes, _mm256_xor_si256(dec_pos, key_bits));
+
+			sum_vec = _mm256_add_epi64(sum_vec, _mm256_sad_epu8(bytes, zero_vec));
+
+			if (decode)
+				bytes = _mm256_xor_si256(_mm256_sub_epi8(bytes, enc_pos), enc_pos);
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), bytes);
+
+			enc_pos = _mm256_add_epi8(enc_pos, step_pos);
+			dec_pos = _mm256_add_epi8(dec_pos, step_pos);
+		}
+
+		const __m128i sum_128 = _mm_add_epi64(_mm256_castsi256_si128(sum_vec), _mm256_extracti128_si256(sum_vec, 1));
+		const uint32_t sum = _mm_cvtsi128_si32(sum_128) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum_128, sum_128));
+		return (crypt_kernel_scalar<decrypt, decode>(key, seed, src, dst, size, i, sum));
+	}
+	#endif
+
+
+	template<template<bool, bool> class kernel>
+	static uint32_t dispatch_kernel(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size, bool decode) {
+		if (key != 0) {
+			if (decode)
+				return (kernel< true,  true>::call(key, seed, src, dst, size));
+
+			return (kernel< true, false>::call(key, seed, src, dst, size));
+		}
+
+		if (decode)
+			return (kernel<false,  true>::call(key, seed, src, dst, size));
+
+		return (kernel<false, false>::call(key, seed, src, dst, size));
+	}
+
+	template<bool decrypt, bool decode> struct scalar_kernel { static uint32_t call(uint8_t k, uint8_t s, const char* src, char* dst, size_t n) { return (crypt_kernel_scalar<decrypt, decode>(k, s, src, dst, n)); } };
+	#ifdef HAPINESS_CRYPT_X86
+	template<bool decrypt, bool decode> struct sse2_kernel   { static uint32_t call(uint8_t k, uint8_t s, const char* src, char* dst, size_t n) { return (crypt_kernel_sse2  <decrypt, decode>(k, s, src, dst, n)); } };
+	template<bool decrypt, bool decode> struct avx2_kernel   { static uint32_t call(uint8_t k, uint8_t s, const char* src, char* dst, size_t n) { return (crypt_kernel_avx2  <decrypt, decode>(k, s, src, dst, n)); } };
+	#endif
+
+
+	static bool is_kernel_supported(crypt_kernel_type type) {
+		#ifdef HAPINESS_CRYPT_X86
+		// this also runs from a static initializer, possibly before libgcc has filled in
+		// the cpu model that __builtin_cpu_supports reads
+		__builtin_cpu_init();
+		#endif
+
+		switch (type) {
+			case CRYPT_KERNEL_SCALAR: { return true; } break;
+			#ifdef HAPINESS_CRYPT_X86
+			case CRYPT_KERNEL_SSE2  : { return (__builtin_cpu_supports("sse2")); } break;
+			case CRYPT_KERNEL_AVX2  : { return (__builtin_cpu_supports("avx2")); } break;
+			#endif
+			default                 : {                                         } break;
+		}
+
+		return false;
+	}
+
+	static crypt_kernel_func get_kernel_func(crypt_kernel_type type) {
+		switch (type) {
+			#ifdef HAPINESS_CRYPT_X86
+			case CRYPT_KERNEL_SSE2: { return (dispatch_kernel<sse2_kernel>); } break;
+			case CRYPT_KERNEL_AVX2: { return (dispatch_kernel<avx2_kernel>); } break;
+			#endif
+			default               : {                                        } break;
+		}
+
+		return (dispatch_kernel<scalar_kernel>);
+	}
+
+	static crypt_kernel_type detect_crypt_kernel() {
+		if (is_kernel_supported(CRYPT_KERNEL_AVX2))
+			return CRYPT_KERNEL_AVX2;
+		if (is_kernel_supported(CRYPT_KERNEL_SSE2))
+			return CRYPT_KERNEL_SSE2;
+
+		return CRYPT_KERNEL_SCALAR;
+	}
+
+
+	static std::atomic<crypt_kernel_type> crypt_kernel = {detect_crypt_kernel()};
+	static std::atomic<crypt_kernel_func> crypt_kernel_ptr = {get_kernel_func(crypt_kernel)};
+
+	crypt_kernel_type get_crypt_kernel() { return crypt_kernel; }
+
+	bool set_crypt_kernel(crypt_kernel_type type) {
+		if (!is_kernel_supported(type))
+			return false;
+
+		crypt_kernel = type;
+		crypt_kernel_ptr = get_kernel_func(type);
+		return true;
+	}
+
+	const char* crypt_kernel_name(crypt_kernel_type type) {
+		switch (type) {
+			case CRYPT_KERNEL_SCALAR: { return "scalar"; } break;
+			case CRYPT_KERNEL_SSE2  : { return "sse2"  ; } break;
+			case CRYPT_KERNEL_AVX2  : { return "avx2"  ; } break;
+			default                 : {                } break;
+		}
+
+		return "????";
+	}
+
+
+	uint32_t decrypt_chunk_buffer(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size, bool decode) {
+		return ((*crypt_kernel_ptr.load(std::memory_order_relaxed))(key, seed, src, dst, size, decode));
+	}
+
+	uint32_t decrypt_chunk_buffer_scalar(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size, bool decode) {
+		return (dispatch_kernel<scalar_kernel>(key, seed, src, dst, size, decode));
+	}
+
+	uint32_t compute_buffer_checksum(const char* buffer, size_t size) {
+		uint32_t sum = 0;
+
+		#ifdef HAPINESS_CRYPT_X86
+		const __m128i zero_vec = _mm_setzero_si128();
+
+		__m128i sum_vec = zero_vec;
+
+		size_t i = 0;
+
+		// SSE2 is part of the x86-64 baseline, wider paths are not worth it for a pure reduction
+		for (; (i + 16) <= size; i += 16) {
+			sum_vec = _mm_add_epi64(sum_vec, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i)), zero_vec));
+		}
+
+		sum = _mm_cvtsi128_si32(sum_vec) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum_vec, sum_vec));
+
+		for (; i < size; ++i) {
+			sum += static_cast<uint8_t>(buffer[i]);
+		}
+		#else
+		for (size_t i = 0; i < size; ++i) {
+			sum += static_cast<uint8_t>(buffer[i]);
+		}
+		#endif
+
+		return sum;
+	}
+}
+
@@ -0,0 +1,38 @@
+#ifndef HAPINESS_CRYPT_UTIL_HDR
+#define HAPINESS_CRYPT_UTIL_HDR
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+	enum crypt_kernel_type {
+		CRYPT_KERNEL_SCALAR = 0,
+		CRYPT_KERNEL_SSE2   = 1,
+		CRYPT_KERNEL_AVX2   = 2,
+	};
+
+	// the widest kernel supported by the CPU is picked on first use
+	crypt_kernel_type get_crypt_kernel();
+	// returns false (and keeps the current kernel) if <type> is not supported
+	bool set_crypt_kernel(crypt_kernel_type type);
+
+	const char* crypt_kernel_name(crypt_kernel_type type);
+
+
+	// single pass over <size> bytes from <src> into <dst> (which may equal <src>):
+	// decrypts with <key> and <seed> (position of the first byte in the archive)
+	// unless key is 0, then decodes by chunk position if <decode> is set; returns
+	// the checksum of the decrypted but not yet decoded bytes
+	uint32_t decrypt_chunk_buffer(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size, bool decode);
+	// reference implementation of the above
+	uint32_t decrypt_chunk_buffer_scalar(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size, bool decode);
+
+	uint32_t compute_buffer_checksum(const char* buffer, size_t size);
+
+	inline void decrypt_buffer(uint8_t key, uint8_t seed, const char* src, char* dst, size_t size) {
+		decrypt_chunk_buffer(key, seed, src, dst, size, false);
+	}
+}
+
+#endif
+
@@ -1,12 +1,154 @@
 #include <cstdint>
+#include <cstring>
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#else
 #include <zlib.h>
+#endif
 
 #include "decompress_util.hpp"
 #include "archive_util.hpp"
+#include "stats_util.hpp"
 
 namespace util {
-	void decompress_lz77(const char* in, size_t len, char* out, size_t max_bytes) {
-		char window[4096];
+	// output byte k ends up in window slot (k + 1) & 0xFFF, so a window offset is just a
+	// distance back into the output produced so far; bytes from before the start of the
+	// chunk read as zero (which the window-based reference decoder also yields)
+	static uint32_t lz77_window_distance(size_t out_pos, uint32_t offset) {
+		const uint32_t distance = ((out_pos + 1) - offset) & 0xFFF;
+		return ((distance == 0)? 4096: distance);
+	}
+
+	static void copy_lz77_match(char* out, size_t out_pos, uint32_t distance, uint32_t count) {
+		char* dst = out + out_pos;
+
+		if (distance > out_pos) {
+			// (partially) before the start of output
+			for (uint32_t x = 0; x < count; ++x) {
+				dst[x] = ((out_pos + x) >= distance)? out[out_pos + x - distance]: 0;
+			}
+
+			return;
+		}
+
+		const char* src = dst - distance;
+
+		if (distance >= count) {
+			std::memcpy(dst, src, count);
+			return;
+		}
+
+		if (distance == 1) {
+			std::memset(dst, *src, count);
+			return;
+		}
+
+		// overlapping, repeats the last <distance> bytes
+		for (uint32_t x = 0; x < count; ++x) {
+			dst[x] = src[x];
+		}
+	}
+
+	size_t decompress_lz77(const char* in, size_t len, char* out, size_t max_bytes) {
+		const perf_timer timer(PERF_COUNTER_LZ77_NS);
+
+		char error[256];
+
+		add_perf_counter(PERF_COUNTER_LZ77_BYTES, max_bytes);
+
+		size_t in_pos = 0;
+		size_t out_pos = 0;
+
+		while (true) {
+			if (in_pos >= len) {
+				snprintf(error, sizeof(error) - 1, "[%s] expected tag, got end of input", __func__);
+				throw hpi_exception(error);
+			}
+
+			uint8_t tag = static_cast<uint8_t>(in[in_pos++]);
+
+			// fast path; a group of 8 items consumes at most 16 input and 8 * 17 output bytes
+			if ((len - in_pos) >= (8 * 2) && (max_bytes - out_pos) >= (8 * 17)) {
+				if (tag == 0) {
+					std::memcpy(out + out_pos, in + in_pos, 8);
+
+					in_pos += 8;
+					out_pos += 8;
+					continue;
+				}
+
+				for (uint32_t i = 0; i < 8; ++i, tag >>= 1) {
+					if ((tag & 1) == 0) {
+						out[out_pos++] = in[in_pos++];
+						continue;
+					}
+
+					uint16_t packed_data;
+					std::memcpy(&packed_data, in + in_pos, sizeof(packed_data));
+
+					const uint32_t offset = packed_data >> 4;
+					const uint32_t count = (packed_data & 0x0F) + 2;
+
+					in_pos += 2;
+
+					if (offset == 0)
+						return out_pos;
+
+					copy_lz77_match(out, out_pos, lz77_window_distance(out_pos, offset), count);
+					out_pos += count;
+				}
+
+				continue;
+			}
+
+			for (uint32_t i = 0; i < 8; ++i, tag >>= 1) {
+				if ((tag & 1) == 0) {
+					// next byte is a literal byte
+					if (in_pos >= len) {
+						snprintf(error, sizeof(error) - 1, "[%s] expected byte, got end of input", __func__);
+						throw hpi_exception(error);
+					}
+
+					if (out_pos >= max_bytes) {
+						snprintf(error, sizeof(error) - 1, "[%s][literal] exceeded maximum output size", __func__);
+						throw hpi_exception(error);
+					}
+
+					out[out_pos++] = in[in_pos++];
+					continue;
+				}
+
+				// next bytes point into the sliding window
+				if (in_pos >= (len - 1)) {
+					snprintf(error, sizeof(error) - 1, "[%s] expected window offset/length, got end of input", __func__);
+					throw hpi_exception(error);
+				}
+
+				uint16_t packed_data;
+				std::memcpy(&packed_data, in + in_pos, sizeof(packed_data));
+
+				const uint32_t offset = packed_data >> 4;
+				const uint32_t count = (packed_data & 0x0F) + 2;
+
+				in_pos += 2;
+
+				if (offset == 0)
+					return out_pos;
+
+				if ((out_pos + count) > max_bytes) {
+					snprintf(error, sizeof(error) - 1, "[%s][window] exceeded maximum output size", __func__);
+					throw hpi_exception(error);
+				}
+
+				copy_lz77_match(out, out_pos, lz77_window_distance(out_pos, offset), count);
+				out_pos += count;
+			}
+		}
+	}
+
+	size_t decompress_lz77_reference(const char* in, size_t len, char* out, size_t max_bytes) {
+		// note: zero-filled so references before the start of output are deterministic
+		char window[4096] = {0};
 		char error[256];
 
 		size_t in_pos = 0;
@@ -45,14 +187,16 @@ namespace util {
 						throw hpi_exception(error);
 					}
 
-					uint32_t packed_data = *(reinterpret_cast<const uint16_t*>(&in[in_pos]));
+					uint16_t packed_data;
+					std::memcpy(&packed_data, &in[in_pos], sizeof(packed_data));
+
 					uint32_t offset = packed_data >> 4;
 					uint32_t count = (packed_data & 0x0F) + 2;
 
 					in_pos += 2;
 
 					if (offset == 0)
-						return;
+						return out_pos;
 
 					if ((out_pos + count) > max_bytes) {
 						snprintf(error, sizeof(error) - 1, "[%s][window] exceeded maximum output size", __func__);
@@ -73,33 +217,113 @@ namespace util {
 		}
 	}
 
-	void decompress_zlib(const char* in, size_t len, char* out, size_t max_bytes) {
+	#ifdef USE_LIBDEFLATE
+	struct zlib_context::backend_state {
+		backend_state(): decompressor(libdeflate_alloc_decompressor()) {}
+		~backend_state() { libdeflate_free_decompressor(decompressor); }
+
+		libdeflate_decompressor* decompressor = nullptr;
+	};
+	#else
+	struct zlib_context::backend_state {
+		backend_state() {
+			stream.zalloc = Z_NULL;
+			stream.zfree = Z_NULL;
+			stream.opaque = Z_NULL;
+			stream.avail_in = 0;
+			stream.next_in = Z_NULL;
+
+			initialized = (inflateInit(&stream) == Z_OK);
+		}
+		~backend_state() {
+			if (initialized)
+				inflateEnd(&stream);
+		}
+
 		z_stream stream;
+		bool initialized = false;
+	};
+	#endif
+
+
+	zlib_context::zlib_context(): state(new backend_state()) {}
+	zlib_context::~zlib_context() {}
+
+	zlib_context& zlib_context::get_thread_context() {
+		static thread_local zlib_context context;
+		return context;
+	}
+
+	const char* zlib_context::get_backend_name() {
+		#ifdef USE_LIBDEFLATE
+		return "libdeflate";
+		#else
+		return "zlib";
+		#endif
+	}
+
+
+	size_t decompress_zlib(const char* in, size_t len, char* out, size_t max_bytes) {
+		return decompress_zlib(zlib_context::get_thread_context(), in, len, out, max_bytes);
+	}
+
+	#ifdef USE_LIBDEFLATE
+	size_t decompress_zlib(zlib_context& context, const char* in, size_t len, char* out, size_t max_bytes) {
+		const perf_timer timer(PERF_COUNTER_ZLIB_NS);
+
+		libdeflate_decompressor* decompressor = context.state->decompressor;
+
+		size_t num_bytes = 0;
+		char error[256];
+
+		add_perf_counter(PERF_COUNTER_ZLIB_BYTES, max_bytes);
+
+		if (decompressor == nullptr) {
+			snprintf(error, sizeof(error) - 1, "[%s] initialization failed", __func__);
+			throw hpi_exception(error);
+		}
+
+		// chunks are complete zlib streams, decode each in one shot
+		if (libdeflate_zlib_decompress(decompressor, in, len, out, max_bytes, &num_bytes) != LIBDEFLATE_SUCCESS) {
+			snprintf(error, sizeof(error) - 1, "[%s] inflation failed", __func__);
+			throw hpi_exception(error);
+		}
+
+		return num_bytes;
+	}
+	#else
+	size_t decompress_zlib(zlib_context& context, const char* in, size_t len, char* out, size_t max_bytes) {
+		const perf_timer timer(PERF_COUNTER_ZLIB_NS);
+
+		z_stream& stream = context.state->stream;
 		char error[256];
 
-		stream.zalloc = Z_NULL;
-		stream.zfree = Z_NULL;
-		stream.opaque = Z_NULL;
-		stream.avail_in = 0;
-		stream.next_in = Z_NULL;
+		add_perf_counter(PERF_COUNTER_ZLIB_BYTES, max_bytes);
 
-		if (inflateInit(&stream) != Z_OK) {
+		if (!context.state->initialized) {
 			snprintf(error, sizeof(error) - 1, "[%s] initialization failed", __func__);
 			throw hpi_exception(error);
 		}
 
+		// keeps the allocated window and tables from the previous chunk
+		if (inflateReset(&stream) != Z_OK) {
+			snprintf(error, sizeof(error) - 1, "[%s] reset failed", __func__);
+			throw hpi_exception(error);
+		}
+
 		stream.avail_in = static_cast<uInt>(len);
 		stream.next_in = reinterpret_cast<uint8_t*>(const_cast<char*>(in));
 		stream.avail_out = static_cast<uInt>(max_bytes);
 		stream.next_out = reinterpret_cast<uint8_t*>(out);
 
-		if (inflate(&stream, Z_NO_FLUSH) != Z_STREAM_END) {
-			inflateEnd(&stream);
+		// chunks are complete zlib streams, decode each in one shot
+		if (inflate(&stream, Z_FINISH) != Z_STREAM_END) {
 			snprintf(error, sizeof(error) - 1, "[%s] inflation failed", __func__);
 			throw hpi_exception(error);
 		}
 
-		inflateEnd(&stream);
+		return (max_bytes - stream.avail_out);
 	}
+	#endif
 }
 
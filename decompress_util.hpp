@@ -1,9 +1,39 @@
 #ifndef HAPINESS_DECOMPRESS_UTIL_HDR
 #define HAPINESS_DECOMPRESS_UTIL_HDR
 
+#include <memory>
+
 namespace util {
-	void decompress_lz77(const char* in, size_t len, char* out, size_t max_bytes);
-	void decompress_zlib(const char* in, size_t len, char* out, size_t max_bytes);
+	// reusable inflate state, avoids setting up a decompressor for every chunk
+	// note: not thread-safe, each thread should use its own context
+	class zlib_context {
+	public:
+		zlib_context();
+		zlib_context(const zlib_context&) = delete;
+		~zlib_context();
+
+		zlib_context& operator = (const zlib_context&) = delete;
+
+		static zlib_context& get_thread_context();
+		// "zlib" or "libdeflate" (if built with USE_LIBDEFLATE)
+		static const char* get_backend_name();
+
+	private:
+		friend size_t decompress_zlib(zlib_context& context, const char* in, size_t len, char* out, size_t max_bytes);
+
+		struct backend_state;
+		std::unique_ptr<backend_state> state;
+	};
+
+
+	// all of these return the number of bytes written to <out>
+	size_t decompress_lz77(const char* in, size_t len, char* out, size_t max_bytes);
+	// straightforward sliding-window decoder, kept as reference for decompress_lz77
+	// (benchmark_archive checks the two against each other)
+	size_t decompress_lz77_reference(const char* in, size_t len, char* out, size_t max_bytes);
+	size_t decompress_zlib(zlib_context& context, const char* in, size_t len, char* out, size_t max_bytes);
+	// uses the calling thread's context
+	size_t decompress_zlib(const char* in, size_t len, char* out, size_t max_bytes);
 }
 
 #endif
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+#include "archive_util.hpp"
+#include "diff_util.hpp"
+#include "scratch_util.hpp"
+#include "string_util.hpp"
+#include "thread_util.hpp"
+
+namespace util {
+	struct file_pair {
+		const hpi_archive::path_match* old_match;
+		const hpi_archive::path_match* new_match;
+
+		// located chunks of compressed files, empty for stored ones (and once settled)
+		std::vector<hpi_archive::chunk_location> old_chunks;
+		std::vector<hpi_archive::chunk_location> new_chunks;
+
+		// chunks whose content still has to be compared, empty if settled by metadata
+		std::vector<uint32_t> chunks;
+
+		bool changed = false;
+		bool settled = false;
+	};
+
+
+	static bool same_chunk_header(const hpi_chunk& a, const hpi_chunk& b) {
+		return (a.compression_type == b.compression_type && a.encoded == b.encoded && a.compressed_size == b.compressed_size && a.decompressed_size == b.decompressed_size && a.checksum == b.checksum);
+	}
+
+	// settles <pair> if size or (trusted) chunk headers are conclusive, otherwise fills in the chunks to compare
+	static void compare_file_metadata(const hpi_archive& old_archive, const hpi_archive& new_archive, file_pair& pair, bool trust_chunk_headers) {
+		const hpi_archive::file_data& old_file = *pair.old_match->file;
+		const hpi_archive::file_data& new_file = *pair.new_match->file;
+
+		const size_t num_chunks = (new_file.size / HPI_CHUNK_SIZE) + ((new_file.size % HPI_CHUNK_SIZE) != 0);
+
+		if (old_file.size != new_file.size || num_chunks == 0) {
+			pair.changed = (old_file.size != new_file.size);
+			pair.settled = true;
+			return;
+		}
+
+		// stored files (and unreadable headers) leave no locations, those are compared by range
+		if (!old_archive.read_chunk_headers(old_file, pair.old_chunks))
+			pair.old_chunks.clear();
+		if (!new_archive.read_chunk_headers(new_file, pair.new_chunks))
+			pair.new_chunks.clear();
+
+		// headers of files compressed differently never match, their chunks all need comparing
+		const bool same_compression = (old_file.compression_type == new_file.compression_type);
+		const bool valid_headers = trust_chunk_headers && same_compression && !pair.old_chunks.empty() && !pair.new_chunks.empty();
+
+		for (size_t i = 0; i < num_chunks; ++i) {
+			if (valid_headers && same_chunk_header(pair.old_chunks[i].header, pair.new_chunks[i].header))
+				continue;
+
+			pair.chunks.push_back(i);
+		}
+
+		if ((pair.settled = pair.chunks.empty())) {
+			pair.old_chunks = {};
+			pair.new_chunks = {};
+		}
+	}
+
+	// decompresses chunk <chunk_index> of <file> into <buffer>, straight from its located
+	// header if there is one so the chunk-size table is never read
+	static size_t extract_pair_chunk(const hpi_archive& archive, const hpi_archive::file_data& file, const std::vector<hpi_archive::chunk_location>& chunks, size_t chunk_index, scratch_buffer& buffer) {
+		const size_t offset = chunk_index * HPI_CHUNK_SIZE;
+		const size_t length = std::min<size_t>(HPI_CHUNK_SIZE, file.size - offset);
+
+		if (chunks.empty())
+			return (archive.extract_range(file, offset, length, resize_scratch_buffer(buffer, length)));
+
+		const hpi_chunk& header = chunks[chunk_index].header;
+
+		if (header.decompressed_size != length) {
+			char error[256];
+			snprintf(error, sizeof(error) - 1, "[%s] decompressed size %u differs from expected size %lu for chunk %lu", __func__, header.decompressed_size, length, chunk_index);
+			throw hpi_exception(error);
+			return 0;
+		}
+
+		return (archive.extract_file_chunk(chunks[chunk_index], chunk_index, resize_scratch_buffer(buffer, length)));
+	}
+
+	// compares the decompressed data of the chunks left by compare_file_metadata
+	static void compare_file_content(const hpi_archive& old_archive, const hpi_archive& new_archive, file_pair& pair, uint64_t& num_bytes) {
+		static thread_local scratch_buffer old_buffer;
+		static thread_local scratch_buffer new_buffer;
+
+		const hpi_archive::file_data& old_file = *pair.old_match->file;
+		const hpi_archive::file_data& new_file = *pair.new_match->file;
+
+		for (const uint32_t i: pair.chunks) {
+			const size_t old_length = extract_pair_chunk(old_archive, old_file, pair.old_chunks, i, old_buffer);
+			const size_t new_length = extract_pair_chunk(new_archive, new_file, pair.new_chunks, i, new_buffer);
+
+			num_bytes += (old_length + new_length);
+
+			// the first difference decides
+			if (old_length != new_length || std::memcmp(old_buffer.data(), new_buffer.data(), new_length) != 0) {
+				pair.changed = true;
+				break;
+			}
+		}
+
+		pair.old_chunks = {};
+		pair.new_chunks = {};
+		pair.settled = true;
+	}
+
+	static void run_pairs(std::vector<file_pair*>& pairs, thread_pool* pool, const std::function<void(file_pair&)>& func) {
+		if (pool != nullptr) {
+			pool->parallel_for(pairs.size(), [&](size_t i) { func(*pairs[i]); });
+			return;
+		}
+
+		for (file_pair* pair: pairs) {
+			func(*pair);
+		}
+	}
+
+
+	archive_diff diff_archives(const hpi_archive& old_archive, const hpi_archive& new_archive, const archive_diff_params& params, thread_pool* pool) {
+		typedef std::chrono::steady_clock clock;
+		typedef std::chrono::duration<double> seconds;
+
+		archive_diff diff;
+
+		const clock::time_point t0 = clock::now();
+
+		// both lists are in case-folded path order, so matching them is a merge
+		const std::vector<hpi_archive::path_match> old_files = old_archive.find_files_in_path({});
+		const std::vector<hpi_archive::path_match> new_files = new_archive.find_files_in_path({});
+
+		std::vector<file_pair> pairs;
+
+		for (size_t i = 0, j = 0; i < old_files.size() || j < new_files.size(); ) {
+			const int cmp = (i == old_files.size())? 1: ((j == new_files.size())? -1: str_compare_nocase(old_files[i].path, new_files[j].path));
+
+			if (cmp < 0) {
+				diff.removed.emplace_back(old_files[i++].path);
+				continue;
+			}
+
+			if (cmp > 0) {
+				diff.added.emplace_back(new_files[j++].path);
+				continue;
+			}
+
+			pairs.emplace_back();
+			pairs.back().old_match = &old_files[i++];
+			pairs.back().new_match = &new_files[j++];
+		}
+
+		const clock::time_point t1 = clock::now();
+
+		std::vector<file_pair*> pending(pairs.size());
+		std::transform(pairs.begin(), pairs.end(), pending.begin(), [](file_pair& p) { return &p; });
+
+		run_pairs(pending, pool, [&](file_pair& pair) { compare_file_metadata(old_archive, new_archive, pair, params.trust_chunk_headers); });
+
+		for (const file_pair& pair: pairs) {
+			if (!pair.settled)
+				continue;
+
+			// a pair without chunks either differs in size or is empty on both sides
+			diff.num_by_size += pair.chunks.empty() && (pair.changed || pair.new_match->file->size == 0);
+			diff.num_by_chunks += !pair.changed && pair.new_match->file->size != 0;
+		}
+
+		const clock::time_point t2 = clock::now();
+
+		pending.erase(std::remove_if(pending.begin(), pending.end(), [](const file_pair* p) { return p->settled; }), pending.end());
+
+		std::mutex bytes_mutex;
+
+		run_pairs(pending, pool, [&](file_pair& pair) {
+			uint64_t num_bytes = 0;
+
+			compare_file_content(old_archive, new_archive, pair, num_bytes);
+
+			const std::lock_guard<std::mutex> lock(bytes_mutex);
+			diff.content_bytes += num_bytes;
+		});
+
+		diff.num_by_content = pending.size();
+
+		const clock::time_point t3 = clock::now();
+
+		for (const file_pair& pair: pairs) {
+			if (pair.changed) {
+				diff.changed.emplace_back(pair.new_match->path);
+			} else {
+				diff.num_unchanged += 1;
+			}
+		}
+
+		diff.match_time = seconds(t1 - t0).count();
+		diff.metadata_time = seconds(t2 - t1).count();
+		diff.content_time = seconds(t3 - t2).count();
+		return diff;
+	}
+}
+
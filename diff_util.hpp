@@ -0,0 +1,53 @@
+#ifndef HAPINESS_DIFF_UTIL_HDR
+#define HAPINESS_DIFF_UTIL_HDR
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace util {
+	class hpi_archive;
+	class thread_pool;
+
+	struct archive_diff_params {
+		// takes chunks whose headers match on both sides as equal instead of comparing their
+		// content; fast, but a checksum is only a byte sum, so reordered bytes go unnoticed
+		bool trust_chunk_headers = false;
+	};
+
+	struct archive_diff {
+		// paths are matched case-insensitively; added and changed files are spelled as in
+		// the new archive, removed ones as in the old, all in case-folded path order
+		std::vector<std::string> added;
+		std::vector<std::string> removed;
+		std::vector<std::string> changed;
+
+		size_t num_unchanged = 0;
+
+		// how the pairs present in both archives were settled; pairs settled by chunks were
+		// taken as equal on their headers alone (trust_chunk_headers)
+		size_t num_by_size = 0;
+		size_t num_by_chunks = 0;
+		size_t num_by_content = 0;
+
+		// decompressed bytes compared (both sides), zero if metadata settled everything
+		uint64_t content_bytes = 0;
+
+		// wall-clock seconds of each stage
+		double match_time = 0.0;
+		double metadata_time = 0.0;
+		double content_time = 0.0;
+	};
+
+
+	// pairs the files of both archives by path, then settles each pair by the cheapest
+	// conclusive check: a different size, or else by decompressing and comparing their
+	// chunks, stopping at the first that does not match; with trust_chunk_headers, files
+	// compressed the same way only compare the chunks whose headers (compression type,
+	// encoding, sizes and checksum) differ and are equal if there are none
+	// note: pairs are checked in parallel on <pool> if set
+	archive_diff diff_archives(const hpi_archive& old_archive, const hpi_archive& new_archive, const archive_diff_params& params, thread_pool* pool = nullptr);
+}
+
+#endif
+
@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index_util.hpp"
+
+namespace util {
+	bool get_archive_file_stamp(const std::string& file_path, archive_file_stamp& stamp) {
+		struct stat sb;
+
+		if (stat(file_path.c_str(), &sb) != 0)
+			return false;
+
+		stamp.file_size = sb.st_size;
+		stamp.mtime_ns = uint64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+		stamp.inode = sb.st_ino;
+		stamp.device = sb.st_dev;
+		return true;
+	}
+
+	std::string get_canonical_path(const std::string& file_path) {
+		char* path = realpath(file_path.c_str(), nullptr);
+
+		if (path == nullptr)
+			return file_path;
+
+		const std::string canonical_path(path);
+
+		free(path);
+		return canonical_path;
+	}
+
+	std::string make_index_path(const std::string& index_dir, const std::string& archive_path) {
+		// FNV-1a of the full path keeps equally named archives in different directories apart
+		uint64_t path_hash = 0xCBF29CE484222325;
+
+		for (const char c: archive_path) {
+			path_hash = (path_hash ^ static_cast<uint8_t>(c)) * 0x100000001B3;
+		}
+
+		const size_t name_pos = archive_path.find_last_of('/');
+		const std::string name = (name_pos == std::string::npos)? archive_path: archive_path.substr(name_pos + 1);
+
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix) - 1, "-%016lx.hpx", path_hash);
+
+		if (index_dir.empty() || index_dir.back() == '/')
+			return (index_dir + name + suffix);
+
+		return (index_dir + "/" + name + suffix);
+	}
+
+	uint64_t compute_index_checksum(const char* data, size_t size) {
+		// independent lanes keep the multiplies from serializing
+		uint64_t lanes[4] = {size, size ^ 1, size ^ 2, size ^ 3};
+		size_t i = 0;
+
+		for (; (i + sizeof(lanes)) <= size; i += sizeof(lanes)) {
+			for (size_t k = 0; k < 4; ++k) {
+				uint64_t word;
+				std::memcpy(&word, data + i + k * sizeof(word), sizeof(word));
+
+				lanes[k] = (lanes[k] ^ word) * 0x9E3779B97F4A7C15;
+				lanes[k] ^= (lanes[k] >> 29);
+			}
+		}
+
+		uint64_t hash = lanes[0];
+
+		for (size_t k = 1; k < 4; ++k) {
+			hash = ((hash ^ lanes[k]) * 0x9E3779B97F4A7C15);
+			hash ^= (hash >> 29);
+		}
+
+		for (; i < size; ++i) {
+			hash = ((hash ^ static_cast<uint8_t>(data[i])) * 0x9E3779B97F4A7C15);
+		}
+
+		return hash;
+	}
+
+	bool write_index_file(const std::string& index_path, const std::vector<char>& index_data) {
+		const std::string temp_path = index_path + ".tmp" + std::to_string(getpid());
+
+		{
+			std::ofstream stream(temp_path, std::ios::binary);
+
+			if (!stream.is_open())
+				return false;
+
+			stream.write(index_data.data(), index_data.size());
+
+			if (!stream.good()) {
+				stream.close();
+				unlink(temp_path.c_str());
+				return false;
+			}
+		}
+
+		if (rename(temp_path.c_str(), index_path.c_str()) != 0) {
+			unlink(temp_path.c_str());
+			return false;
+		}
+
+		return true;
+	}
+}
+
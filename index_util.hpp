@@ -0,0 +1,101 @@
+#ifndef HAPINESS_INDEX_UTIL_HDR
+#define HAPINESS_INDEX_UTIL_HDR
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace util {
+	// magic number at start of index sidecars ("HPIX")
+	static constexpr uint32_t HPI_INDEX_MAGIC_NUMBER = 0x58495048;
+
+	// bumped whenever the sidecar layout changes
+	static constexpr uint32_t HPI_INDEX_VERSION_NUMBER = 1;
+
+
+	// identifies the exact archive file an index was built from
+	struct archive_file_stamp {
+		uint64_t file_size = 0;
+		uint64_t mtime_ns = 0;
+		uint64_t inode = 0;
+		uint64_t device = 0;
+
+		bool operator == (const archive_file_stamp& s) const {
+			return (file_size == s.file_size && mtime_ns == s.mtime_ns && inode == s.inode && device == s.device);
+		}
+	};
+
+	// sidecar layout: header, then the sections below in order, each starting at a
+	// multiple of 8 bytes; all offsets in the sections are absolute archive offsets
+	// or indices, never pointers
+	struct hpi_index_header {
+		uint32_t magic = HPI_INDEX_MAGIC_NUMBER;
+		uint32_t version = HPI_INDEX_VERSION_NUMBER;
+
+		archive_file_stamp stamp;
+
+		// covers everything after the header
+		uint64_t payload_size = 0;
+		uint64_t payload_checksum = 0;
+
+		// section sizes: canonical archive path, entry names, entry table, lookup
+		// table (both num_entries), compressed files and their chunk offsets
+		uint32_t path_size = 0;
+		uint32_t names_size = 0;
+		uint32_t num_entries = 0;
+		uint32_t num_root_entries = 0;
+		uint32_t num_chunk_files = 0;
+		uint32_t num_chunks = 0;
+
+		// transformed header key
+		uint8_t decrypt_key = 0;
+		uint8_t padding[7] = {0};
+	};
+
+	struct hpi_index_entry {
+		// name is a view into the names section
+		uint32_t name_offset = 0;
+		uint32_t name_size = 0;
+
+		// files: data offset and size; paths: first entry index and count of their block
+		uint32_t data_offset = 0;
+		uint32_t data_size = 0;
+
+		uint8_t is_path = 0;
+		uint8_t compression_type = 0;
+		uint8_t padding[2] = {0};
+	};
+
+	// chunks of the compressed file at <data_offset> start at chunk_offsets[first_chunk]
+	struct hpi_index_chunk_file {
+		uint32_t data_offset = 0;
+		uint32_t file_size = 0;
+		uint32_t first_chunk = 0;
+	};
+
+	static_assert(sizeof(hpi_index_header    ) == (sizeof(uint32_t) * 2 + sizeof(archive_file_stamp) + sizeof(uint64_t) * 2 + sizeof(uint32_t) * 6 + 8), "");
+	static_assert(sizeof(hpi_index_entry     ) == (sizeof(uint32_t) * 4 + 4), "");
+	static_assert(sizeof(hpi_index_chunk_file) == (sizeof(uint32_t) * 3    ), "");
+
+
+	// all sections are 8-byte aligned within the sidecar
+	inline size_t align_index_section(size_t size) { return ((size + 7) & ~size_t(7)); }
+
+	// returns false if <file_path> can not be stat'ed
+	bool get_archive_file_stamp(const std::string& file_path, archive_file_stamp& stamp);
+	// returns <file_path> with symlinks and relative components resolved, or as-is on failure
+	std::string get_canonical_path(const std::string& file_path);
+
+	// sidecar location for the archive at (canonical) <archive_path> within <index_dir>
+	std::string make_index_path(const std::string& index_dir, const std::string& archive_path);
+
+	// cheap hash over four interleaved word lanes, fast enough to run on every warm open
+	uint64_t compute_index_checksum(const char* data, size_t size);
+
+	// writes to a temporary file first and renames it, so readers never see a partial index
+	bool write_index_file(const std::string& index_path, const std::vector<char>& index_data);
+}
+
+#endif
+
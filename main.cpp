@@ -1,12 +1,36 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <numeric>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <boost/filesystem.hpp>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "aio_util.hpp"
 #include "archive_util.hpp"
+#include "bench_util.hpp"
+#include "diff_util.hpp"
+#include "stats_util.hpp"
+#include "string_util.hpp"
+#include "thread_util.hpp"
+#include "vfs_util.hpp"
+#include "writer_util.hpp"
 
 namespace fs = boost::filesystem;
 
+// set by --index-dir, archives opened by path keep their sidecar indices here
+static std::string archive_index_dir;
+// set by --queue-depth, non-zero makes extraction overlap chunk reads with decompression
+static size_t archive_read_queue_depth = 0;
+
 
 static const char* compression_type_str(uint8_t type) {
 	switch (type) {
@@ -20,77 +44,124 @@ static const char* compression_type_str(uint8_t type) {
 }
 
 
-static void print_path(const std::string& parent, const std::string& name, const util::hpi_archive::path_data& d);
+static void print_path(const util::hpi_archive& archive, const std::string& parent, const std::string& name, const util::hpi_archive::path_data& d);
 static void print_file(const std::string& parent, const std::string& name, const util::hpi_archive::file_data& f);
 
-static void print_entry(const std::string& path, const util::hpi_archive::arch_entry& entry) {
+static void print_entry(const util::hpi_archive& archive, const std::string& path, const util::hpi_archive::arch_entry& entry) {
 	if (const util::hpi_archive::file_data* f = boost::get<util::hpi_archive::file_data>(&entry.data); f != nullptr) {
-		print_file(path, entry.name, *f);
+		print_file(path, std::string(entry.name), *f);
 		return;
 	}
 
 	if (const util::hpi_archive::path_data* d = boost::get<util::hpi_archive::path_data>(&entry.data); d != nullptr) {
-		print_path(path, entry.name, *d);
+		print_path(archive, path, std::string(entry.name), *d);
 		return;
 	}
 }
 
 
-static void print_path(const std::string& parent, const std::string& name, const util::hpi_archive::path_data& d) {
+static void print_path(const util::hpi_archive& archive, const std::string& parent, const std::string& name, const util::hpi_archive::path_data& d) {
 	if (parent.empty()) {
-		for (const util::hpi_archive::arch_entry& entry: d.entries) {
-			print_entry(name, entry);
+		for (const util::hpi_archive::arch_entry& entry: archive.get_entries(d)) {
+			print_entry(archive, name, entry);
 		}
 	} else {
-		for (const util::hpi_archive::arch_entry& entry: d.entries) {
-			print_entry(parent + "/" + name, entry);
+		for (const util::hpi_archive::arch_entry& entry: archive.get_entries(d)) {
+			print_entry(archive, parent + "/" + name, entry);
 		}
 	}
 }
 
 static void print_file(const std::string& parent, const std::string& name, const util::hpi_archive::file_data& f) {
 	if (parent.empty()) {
-		fprintf(stdout, "\t%s (%lu bytes, %scompressed)\n", name.c_str(), f.size, compression_type_str(f.compression_type));
+		fprintf(stdout, "\t%s (%u bytes, %scompressed)\n", name.c_str(), f.size, compression_type_str(f.compression_type));
 	} else {
-		fprintf(stdout, "\t%s/%s (%lu bytes, %scompressed)\n", parent.c_str(), name.c_str(), f.size, compression_type_str(f.compression_type));
+		fprintf(stdout, "\t%s/%s (%u bytes, %scompressed)\n", parent.c_str(), name.c_str(), f.size, compression_type_str(f.compression_type));
 	}
 }
 
 
-static int handle_list_files_command(const std::string& archive_file_path) {
+// raw descriptors let hpi_archive::extract_to_file copy stored files kernel-side
+static int open_target_file(const std::string& file_name) {
+	return (open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+}
+
+// prefer opening by path (memory-mapped or positional reads), fall back to reading through <stream>
+static bool open_archive(util::hpi_archive& archive, std::ifstream& stream, const std::string& archive_file_path) {
+	archive.set_index_dir(archive_index_dir);
+	archive.set_read_queue_depth(archive_read_queue_depth);
+
+	if (archive.open(archive_file_path))
+		return true;
+
+	if (stream.open(archive_file_path, std::ios::binary), !stream.is_open())
+		return false;
+
+	return (archive.open(&stream));
+}
+
+
+// a trailing slash selects a whole directory, anything else is a glob (see hpi_archive::find_files_matching)
+static std::vector<util::hpi_archive::path_match> find_pattern_files(const util::hpi_archive& archive, const std::string& pattern) {
+	if (!pattern.empty() && pattern.back() == '/')
+		return (archive.find_files_in_path(pattern));
+
+	return (archive.find_files_matching(pattern));
+}
+
+static int handle_list_files_command(const std::string& archive_file_path, const std::vector<std::string>& patterns) {
 	fprintf(stdout, "[%s] opening archive '%s'\n", __func__, archive_file_path.c_str());
 
 	std::ifstream file_stream;
 	util::hpi_archive file_archive;
 
-	if (file_stream.open(archive_file_path, std::ios::binary), !file_stream.is_open()) {
+	if (!open_archive(file_archive, file_stream, archive_file_path)) {
 		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, archive_file_path.c_str());
 		return EXIT_FAILURE;
 	}
 
-	file_archive.open(&file_stream);
+	if (patterns.empty()) {
+		fprintf(stdout, "[%s] listing archive contents\n", __func__);
+		print_path(file_archive, "", ".", file_archive.get_root_path());
+		return EXIT_SUCCESS;
+	}
+
+	for (const std::string& pattern: patterns) {
+		const auto t0 = std::chrono::steady_clock::now();
+		const std::vector<util::hpi_archive::path_match> matches = find_pattern_files(file_archive, pattern);
+		const auto t1 = std::chrono::steady_clock::now();
+
+		// the first query includes building the path index
+		fprintf(stdout, "[%s] %lu files matching '%s' (%.1f us)\n", __func__, matches.size(), pattern.c_str(), std::chrono::duration<double, std::micro>(t1 - t0).count());
+
+		for (const util::hpi_archive::path_match& match: matches) {
+			print_file("", std::string(match.path), *match.file);
+		}
+	}
 
-	fprintf(stdout, "[%s] listing archive contents\n", __func__);
-	print_path("", ".", file_archive.get_root_path());
 	return EXIT_SUCCESS;
 }
 
-static int handle_extract_file_command(const std::string& archive_file_path, const std::string& src_file_path, const std::string& tgt_file_path) {
+static int handle_extract_file_command(const std::string& archive_file_path, const std::string& src_file_path, const std::string& tgt_file_path, size_t num_jobs) {
 	fprintf(stdout, "[%s] opening archive '%s'\n", __func__, archive_file_path.c_str());
 
 	std::ifstream in_file_stream;
-	std::ofstream out_file_stream;
 	util::hpi_archive file_archive;
-	std::vector<char> file_buffer;
 
-	if (in_file_stream.open(archive_file_path, std::ios::binary), !in_file_stream.is_open()) {
+	// single file, spread its chunks over the other jobs
+	std::unique_ptr<util::thread_pool> chunk_pool((num_jobs > 1)? new util::thread_pool(num_jobs - 1): nullptr);
+
+	// only the directories along the source path get parsed
+	file_archive.set_lazy_directories(true);
+
+	if (!open_archive(file_archive, in_file_stream, archive_file_path)) {
 		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, archive_file_path.c_str());
 		return EXIT_FAILURE;
 	}
 
 	fprintf(stdout, "[%s] finding file '%s'\n", __func__, src_file_path.c_str());
 
-	file_archive.open(&in_file_stream);
+	file_archive.set_chunk_pool(chunk_pool.get());
 
 	#ifdef USE_STD_OPTIONAL
 	const std::optional<std::reference_wrapper<const util::hpi_archive::file_data>> entry = file_archive.find_file(src_file_path);
@@ -105,60 +176,226 @@ static int handle_extract_file_command(const std::string& archive_file_path, con
 
 	fprintf(stdout, "[%s] extracting file '%s' to '%s'\n", __func__, src_file_path.c_str(), tgt_file_path.c_str());
 
-	#ifdef USE_STD_OPTIONAL
-	file_buffer.resize(entry->get().size, 0);
-	#else
-	file_buffer.resize(entry->size, 0);
-	#endif
-	file_archive.extract(*entry, file_buffer);
+	const int fd = open_target_file(tgt_file_path);
+
+	if (fd == -1) {
+		fprintf(stderr, "[%s] failed to create file '%s'\n", __func__, tgt_file_path.c_str());
+		return EXIT_FAILURE;
+	}
 
-	out_file_stream.open(tgt_file_path, std::ios::binary);
-	out_file_stream.write(file_buffer.data(), file_buffer.size());
+	file_archive.extract_to_file(*entry, fd);
+	close(fd);
 
 	return EXIT_SUCCESS;
 }
 
+// extracts <files> to <tgt_file_path>/<file_paths> in one pass over the archive
+static void extract_file_batch(util::hpi_archive& file_archive, const std::string& tgt_file_path, const std::vector<const util::hpi_archive::file_data*>& files, const std::vector<std::string>& file_paths, size_t num_jobs) {
+	// files are extracted one by one in archive order, workers only help with chunks
+	std::unique_ptr<util::thread_pool> pool((num_jobs > 1)? new util::thread_pool(num_jobs - 1): nullptr);
+
+	file_archive.set_chunk_pool(pool.get());
+	file_archive.extract_batch(files, [&](size_t i) {
+		const fs::path file_path = fs::path(tgt_file_path) / file_paths[i];
+		const std::shared_ptr<std::ofstream> out_file_stream = std::make_shared<std::ofstream>();
+
+		fs::create_directories(file_path.parent_path());
+		fprintf(stdout, "[%s] extracting file '%s' (%u bytes)\n", __func__, file_path.string().c_str(), files[i]->size);
+
+		out_file_stream->open(file_path.string(), std::ios::binary);
+		return ([out_file_stream](const char* data, size_t size) { out_file_stream->write(data, size); });
+	});
+	file_archive.set_chunk_pool(nullptr);
+}
+
+static int handle_extract_files_command(const std::string& archive_file_path, const std::string& tgt_file_path, const std::vector<std::string>& src_file_paths, size_t num_jobs) {
+	fprintf(stdout, "[%s] opening archive '%s'\n", __func__, archive_file_path.c_str());
+
+	std::ifstream file_stream;
+	util::hpi_archive file_archive;
+
+	// only the directories along the requested paths get parsed
+	file_archive.set_lazy_directories(true);
+
+	if (!open_archive(file_archive, file_stream, archive_file_path)) {
+		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, archive_file_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	std::vector<const util::hpi_archive::file_data*> files;
+	std::vector<std::string> file_paths;
+
+	for (const std::string& src_file_path: src_file_paths) {
+		const auto entry = file_archive.find_file(src_file_path);
+
+		if (!entry) {
+			fprintf(stderr, "[%s] could not find file '%s' in archive\n", __func__, src_file_path.c_str());
+			continue;
+		}
+
+		files.push_back(&static_cast<const util::hpi_archive::file_data&>(*entry));
+		file_paths.push_back(src_file_path);
+	}
+
+	fprintf(stdout, "[%s] extracting %lu of %lu files (%lu jobs)\n", __func__, files.size(), src_file_paths.size(), num_jobs);
+
+	extract_file_batch(file_archive, tgt_file_path, files, file_paths, num_jobs);
+	return ((files.size() == src_file_paths.size())? EXIT_SUCCESS: EXIT_FAILURE);
+}
+
+static int handle_extract_command(const std::string& archive_file_path, const std::string& tgt_file_path, const std::vector<std::string>& patterns, size_t num_jobs) {
+	fprintf(stdout, "[%s] opening archive '%s'\n", __func__, archive_file_path.c_str());
+
+	std::ifstream file_stream;
+	util::hpi_archive file_archive;
+
+	if (!open_archive(file_archive, file_stream, archive_file_path)) {
+		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, archive_file_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	std::vector<const util::hpi_archive::file_data*> files;
+	std::vector<std::string> file_paths;
+	// a file matched by several patterns is only extracted once
+	std::unordered_set<const util::hpi_archive::file_data*> matched_files;
+
+	for (const std::string& pattern: patterns) {
+		const std::vector<util::hpi_archive::path_match> matches = find_pattern_files(file_archive, pattern);
+
+		if (matches.empty())
+			fprintf(stderr, "[%s] no files matching '%s' in archive\n", __func__, pattern.c_str());
+
+		for (const util::hpi_archive::path_match& match: matches) {
+			if (!matched_files.insert(match.file).second)
+				continue;
+
+			files.push_back(match.file);
+			file_paths.emplace_back(match.path);
+		}
+	}
+
+	fprintf(stdout, "[%s] extracting %lu files matching %lu patterns (%lu jobs)\n", __func__, files.size(), patterns.size(), num_jobs);
+
+	extract_file_batch(file_archive, tgt_file_path, files, file_paths, num_jobs);
+	return ((!files.empty())? EXIT_SUCCESS: EXIT_FAILURE);
+}
+
+static void extract_archive_file(const util::hpi_archive& file_archive, const util::hpi_archive::file_data& f, const fs::path& tgt_file_path) {
+	std::string file_name(tgt_file_path.string());
+
+	fprintf(stdout, "[%s] extracting file '%s' (%u bytes)\n", __func__, file_name.c_str(), f.size);
+
+	if (const int fd = open_target_file(file_name); fd != -1) {
+		file_archive.extract_to_file(f, fd);
+		close(fd);
+	} else {
+		fprintf(stderr, "[%s] failed to create file '%s'\n", __func__, file_name.c_str());
+	}
+}
+
 static void extract_archive_rec(util::hpi_archive& file_archive, const util::hpi_archive::arch_entry& entry, const fs::path& tgt_file_path) {
+	const fs::path entry_path = tgt_file_path / std::string(entry.name);
+
 	if (const util::hpi_archive::path_data* d = boost::get<util::hpi_archive::path_data>(&entry.data); d != nullptr) {
-		fs::create_directory(tgt_file_path / entry.name);
+		fs::create_directory(entry_path);
 
-		for (const util::hpi_archive::arch_entry& e: d->entries) {
-			extract_archive_rec(file_archive, e, tgt_file_path / entry.name);
+		for (const util::hpi_archive::arch_entry& e: file_archive.get_entries(*d)) {
+			extract_archive_rec(file_archive, e, entry_path);
 		}
 
 		return;
 	}
 
 	if (const util::hpi_archive::file_data* f = boost::get<util::hpi_archive::file_data>(&entry.data); f != nullptr) {
-		std::string file_name((tgt_file_path / entry.name).string());
-		std::ofstream file_stream(file_name, std::ios::binary);
-		std::vector<char> file_buffer(f->size, 0);
+		extract_archive_file(file_archive, *f, entry_path);
+		return;
+	}
+}
 
-		fprintf(stdout, "[%s] extracting file '%s' (%lu bytes)\n", __func__, file_name.c_str(), file_buffer.size());
 
-		file_archive.extract(*f, file_buffer);
-		file_stream.write(file_buffer.data(), file_buffer.size());
+struct extract_job {
+	const util::hpi_archive::file_data* file;
+	fs::path path;
+};
+
+// creates the directory skeleton and gathers one job per file
+static void collect_extract_jobs(const util::hpi_archive& file_archive, const util::hpi_archive::arch_entry& entry, const fs::path& tgt_file_path, std::vector<extract_job>& jobs) {
+	const fs::path entry_path = tgt_file_path / std::string(entry.name);
+
+	if (const util::hpi_archive::path_data* d = boost::get<util::hpi_archive::path_data>(&entry.data); d != nullptr) {
+		fs::create_directory(entry_path);
+
+		for (const util::hpi_archive::arch_entry& e: file_archive.get_entries(*d)) {
+			collect_extract_jobs(file_archive, e, entry_path, jobs);
+		}
+
+		return;
+	}
+
+	if (const util::hpi_archive::file_data* f = boost::get<util::hpi_archive::file_data>(&entry.data); f != nullptr) {
+		jobs.push_back({f, entry_path});
 		return;
 	}
 }
 
-static int handle_extract_arch_command(const std::string& archive_file_path, const std::string& tgt_file_path) {
+static void extract_archive_jobs(util::hpi_archive& file_archive, const fs::path& tgt_file_path, size_t num_jobs) {
+	std::vector<extract_job> jobs;
+
+	for (const util::hpi_archive::arch_entry& e: file_archive.get_root_entries()) {
+		collect_extract_jobs(file_archive, e, tgt_file_path, jobs);
+	}
+
+	// largest files first so no worker is left with a big straggler at the end
+	std::stable_sort(jobs.begin(), jobs.end(), [](const extract_job& a, const extract_job& b) { return (a.file->size > b.file->size); });
+
+	// calling thread works as well; once no files are left to start, the idle workers
+	// join the chunk batches of the big files still being extracted (started first)
+	// note: files are streamed, so each job only holds a few chunks in memory
+	std::unique_ptr<util::thread_pool> pool((num_jobs > 1)? new util::thread_pool(num_jobs - 1): nullptr);
+
+	const auto run_job = [&](size_t i) {
+		// with queued reads, also start reading the file that comes up once a job is done
+		if (archive_read_queue_depth != 0 && (i + num_jobs) < jobs.size())
+			file_archive.prefetch_file(*jobs[i + num_jobs].file);
+
+		extract_archive_file(file_archive, *jobs[i].file, jobs[i].path);
+	};
+
+	file_archive.set_chunk_pool(pool.get());
+
+	if (pool != nullptr) {
+		pool->parallel_for(jobs.size(), run_job);
+	} else {
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			run_job(i);
+		}
+	}
+
+	file_archive.set_chunk_pool(nullptr);
+}
+
+static int handle_extract_arch_command(const std::string& archive_file_path, const std::string& tgt_file_path, size_t num_jobs) {
 	fprintf(stdout, "[%s] opening archive '%s'\n", __func__, archive_file_path.c_str());
 
 	std::ifstream file_stream;
 	util::hpi_archive file_archive;
 
-	if (file_stream.open(archive_file_path, std::ios::binary), !file_stream.is_open()) {
+	if (!open_archive(file_archive, file_stream, archive_file_path)) {
 		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, archive_file_path.c_str());
 		return EXIT_FAILURE;
 	}
 
-	fprintf(stdout, "[%s] extracting files\n", __func__);
-	file_archive.open(&file_stream);
+	fprintf(stdout, "[%s] extracting files (%lu jobs)\n", __func__, num_jobs);
 
 	// assume target directory does not exist yet
 	fs::create_directory(tgt_file_path);
 
+	// queued reads keep upcoming files in flight too, which needs the job list
+	if (num_jobs > 1 || archive_read_queue_depth != 0) {
+		extract_archive_jobs(file_archive, tgt_file_path, num_jobs);
+		return EXIT_SUCCESS;
+	}
+
 	for (const util::hpi_archive::arch_entry& e: file_archive.get_root_entries()) {
 		extract_archive_rec(file_archive, e, tgt_file_path);
 	}
@@ -167,45 +404,526 @@ static int handle_extract_arch_command(const std::string& archive_file_path, con
 }
 
 
-int main(int argc, char** argv) {
-	if (argc < 2 || strstr(argv[1], "--") != argv[1]) {
-		fprintf(stderr, "[%s] usage: %s <--list-files|--extract-file|--extract-arch>\n", __func__, argv[0]);
+static void collect_verify_files(const util::hpi_archive& file_archive, const util::hpi_archive::entry_list& entries, const std::string& parent, std::vector<std::pair<std::string, const util::hpi_archive::file_data*>>& files) {
+	for (const util::hpi_archive::arch_entry& entry: entries) {
+		const std::string entry_path = parent + std::string(entry.name);
+
+		if (const util::hpi_archive::path_data* d = boost::get<util::hpi_archive::path_data>(&entry.data); d != nullptr) {
+			collect_verify_files(file_archive, file_archive.get_entries(*d), entry_path + "/", files);
+		} else {
+			files.emplace_back(entry_path, &boost::get<util::hpi_archive::file_data>(entry.data));
+		}
+	}
+}
+
+static int handle_verify_command(const std::string& archive_file_path, size_t num_jobs) {
+	fprintf(stdout, "[%s] opening archive '%s'\n", __func__, archive_file_path.c_str());
+
+	std::ifstream file_stream;
+	util::hpi_archive file_archive;
+
+	if (!open_archive(file_archive, file_stream, archive_file_path)) {
+		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, archive_file_path.c_str());
 		return EXIT_FAILURE;
 	}
 
-	try {
-		if (strcmp(argv[1] + 2, "lf") == 0 || strcmp(argv[1] + 2, "list-files") == 0) {
-			if (argc < 3) {
-				fprintf(stderr, "[%s] usage: %s <HPI archive>\n", __func__, argv[1]);
-				return EXIT_FAILURE;
+	std::vector<std::pair<std::string, const util::hpi_archive::file_data*>> files;
+	std::vector<size_t> order;
+
+	collect_verify_files(file_archive, file_archive.get_root_entries(), "", files);
+
+	order.resize(files.size());
+	std::iota(order.begin(), order.end(), 0);
+	// largest files first so no worker is left with a big straggler at the end
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return (files[a].second->size > files[b].second->size); });
+
+	fprintf(stdout, "[%s] verifying %lu files (%lu jobs)\n", __func__, files.size(), num_jobs);
+
+	std::vector<util::hpi_archive::verify_result> results(files.size());
+	// once no files are left to start, idle workers join the chunk loops of the big
+	// files still being verified (started first), so both files and chunks run in parallel
+	std::unique_ptr<util::thread_pool> pool((num_jobs > 1)? new util::thread_pool(num_jobs - 1): nullptr);
+
+	const auto verify_file = [&](size_t i) {
+		results[order[i]] = file_archive.verify(*files[order[i]].second);
+	};
+
+	const auto start_time = std::chrono::steady_clock::now();
+
+	file_archive.set_chunk_pool(pool.get());
+
+	if (pool != nullptr) {
+		pool->parallel_for(files.size(), verify_file);
+	} else {
+		for (size_t i = 0; i < files.size(); ++i) {
+			verify_file(i);
+		}
+	}
+
+	file_archive.set_chunk_pool(nullptr);
+
+	const double verify_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+	size_t num_bytes = 0;
+	size_t num_corrupt = 0;
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		num_bytes += files[i].second->size;
+
+		if (results[i].is_valid())
+			continue;
+
+		std::string chunk_list;
+
+		for (const uint32_t chunk_index: results[i].corrupt_chunks) {
+			chunk_list += (chunk_list.empty()? " (chunks ": ", ") + std::to_string(chunk_index);
+		}
+		if (!chunk_list.empty())
+			chunk_list += ")";
+
+		fprintf(stdout, "[%s] corrupt file '%s'%s: %s\n", __func__, files[i].first.c_str(), chunk_list.c_str(), results[i].error.c_str());
+		num_corrupt += 1;
+	}
+
+	fprintf(stdout, "[%s] verified %lu files (%.2f MB) in %.3f s (%.1f MB/s), %lu corrupt\n", __func__, files.size(), num_bytes / (1024.0 * 1024.0), verify_time, (verify_time > 0.0)? (num_bytes / (verify_time * 1024.0 * 1024.0)): 0.0, num_corrupt);
+	return ((num_corrupt == 0)? EXIT_SUCCESS: EXIT_FAILURE);
+}
+
+
+static int handle_diff_command(const std::string& old_archive_file_path, const std::string& new_archive_file_path, const util::archive_diff_params& params, size_t num_jobs) {
+	std::ifstream old_file_stream;
+	std::ifstream new_file_stream;
+	util::hpi_archive old_archive;
+	util::hpi_archive new_archive;
+
+	if (!open_archive(old_archive, old_file_stream, old_archive_file_path)) {
+		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, old_archive_file_path.c_str());
+		return EXIT_FAILURE;
+	}
+	if (!open_archive(new_archive, new_file_stream, new_archive_file_path)) {
+		fprintf(stderr, "[%s] failed to open archive '%s'\n", __func__, new_archive_file_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stdout, "[%s] comparing '%s' to '%s' (%lu jobs)\n", __func__, old_archive_file_path.c_str(), new_archive_file_path.c_str(), num_jobs);
+
+	std::unique_ptr<util::thread_pool> pool((num_jobs > 1)? new util::thread_pool(num_jobs - 1): nullptr);
+
+	const util::archive_diff diff = util::diff_archives(old_archive, new_archive, params, pool.get());
+
+	for (const std::string& path: diff.added) {
+		fprintf(stdout, "+ %s\n", path.c_str());
+	}
+	for (const std::string& path: diff.removed) {
+		fprintf(stdout, "- %s\n", path.c_str());
+	}
+	for (const std::string& path: diff.changed) {
+		fprintf(stdout, "* %s\n", path.c_str());
+	}
+
+	fprintf(stdout, "[%s] %lu added, %lu removed, %lu changed, %lu unchanged\n", __func__, diff.added.size(), diff.removed.size(), diff.changed.size(), diff.num_unchanged);
+	fprintf(stdout, "[%s] settled %lu pairs by size, %lu by chunk headers, %lu by content (%.2f MB compared)\n", __func__, diff.num_by_size, diff.num_by_chunks, diff.num_by_content, diff.content_bytes / (1024.0 * 1024.0));
+	fprintf(stdout, "[%s] match %.3f ms, metadata %.3f ms, content %.3f ms\n", __func__, diff.match_time * 1000.0, diff.metadata_time * 1000.0, diff.content_time * 1000.0);
+
+	if (diff.num_by_chunks != 0)
+		fprintf(stdout, "[%s] note: %lu unchanged pairs were only checked by chunk headers, not by content\n", __func__, diff.num_by_chunks);
+
+	// like diff(1), differing archives are not a failure but are told apart from equal ones
+	return ((diff.added.empty() && diff.removed.empty() && diff.changed.empty())? EXIT_SUCCESS: 2);
+}
+
+
+static int handle_vfs_list_command(const std::vector<std::string>& archive_file_paths) {
+	fprintf(stdout, "[%s] mounting %lu archives\n", __func__, archive_file_paths.size());
+
+	util::hpi_vfs vfs;
+	util::thread_pool pool;
+
+	vfs.mount(archive_file_paths, &pool);
+
+	fprintf(stdout, "[%s] listing merged contents\n", __func__);
+
+	for (const util::hpi_vfs::vfs_file& f: vfs.get_files()) {
+		fprintf(stdout, "\t%s (%u bytes, %scompressed, from '%s')\n", f.path.c_str(), f.file->size, compression_type_str(f.file->compression_type), vfs.get_archive_path(f.archive_index).c_str());
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int handle_vfs_extract_command(const std::vector<std::string>& archive_file_paths, const std::string& tgt_file_path, size_t num_jobs) {
+	fprintf(stdout, "[%s] mounting %lu archives\n", __func__, archive_file_paths.size());
+
+	util::hpi_vfs vfs;
+	util::thread_pool pool(std::max<size_t>(num_jobs, 2) - 1);
+
+	vfs.mount(archive_file_paths, &pool);
+
+	fprintf(stdout, "[%s] extracting %lu files (%lu jobs)\n", __func__, vfs.get_files().size(), num_jobs);
+
+	std::vector<const util::hpi_vfs::vfs_file*> files;
+
+	for (const util::hpi_vfs::vfs_file& f: vfs.get_files()) {
+		fs::create_directories((fs::path(tgt_file_path) / f.path).parent_path());
+		files.push_back(&f);
+	}
+
+	// largest files first so no worker is left with a big straggler at the end
+	std::stable_sort(files.begin(), files.end(), [](const util::hpi_vfs::vfs_file* a, const util::hpi_vfs::vfs_file* b) { return (a->file->size > b->file->size); });
+
+	const auto extract_file = [&](size_t i) {
+		extract_archive_file(vfs.get_archive(files[i]->archive_index), *files[i]->file, fs::path(tgt_file_path) / files[i]->path);
+	};
+
+	if (num_jobs > 1) {
+		pool.parallel_for(files.size(), extract_file);
+		return EXIT_SUCCESS;
+	}
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		extract_file(i);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+
+static int handle_create_arch_command(const std::string& src_file_path, const std::string& archive_file_path, uint8_t compression_type, uint32_t header_key, bool encode_chunks, size_t num_jobs) {
+	fprintf(stdout, "[%s] collecting files in '%s'\n", __func__, src_file_path.c_str());
+
+	if (!fs::is_directory(src_file_path)) {
+		fprintf(stderr, "[%s] '%s' is not a directory\n", __func__, src_file_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	std::vector<fs::path> file_paths;
+
+	for (fs::recursive_directory_iterator iter(src_file_path), end; iter != end; ++iter) {
+		if (fs::is_directory(iter->status()) || fs::is_regular_file(iter->status())) {
+			file_paths.push_back(fs::relative(iter->path(), src_file_path));
+		}
+	}
+
+	// directory iteration order is unspecified, keep archives reproducible
+	std::sort(file_paths.begin(), file_paths.end());
+
+	util::hpi_archive_writer writer;
+	// note: a pool size of zero would mean one thread per core
+	std::unique_ptr<util::thread_pool> pool((num_jobs > 1)? new util::thread_pool(num_jobs - 1): nullptr);
+
+	for (const fs::path& file_path: file_paths) {
+		const fs::path full_path = fs::path(src_file_path) / file_path;
+
+		if (fs::is_directory(full_path)) {
+			writer.add_path(file_path.generic_string());
+			continue;
+		}
+
+		writer.add_file(file_path.generic_string(), compression_type, [full_path](std::vector<char>& data) {
+			std::ifstream file_stream(full_path.string(), std::ios::binary);
+
+			data.resize(fs::file_size(full_path));
+			file_stream.read(data.data(), data.size());
+
+			if (file_stream.gcount() != static_cast<std::streamsize>(data.size())) {
+				char error[256];
+				snprintf(error, sizeof(error) - 1, "[%s] failed to read '%s'", __func__, full_path.string().c_str());
+				throw util::hpi_exception(error);
 			}
+		});
+	}
+
+	fprintf(stdout, "[%s] writing %lu files to archive '%s' (%lu jobs)\n", __func__, writer.get_num_files(), archive_file_path.c_str(), num_jobs);
+
+	writer.set_header_key(header_key);
+	writer.set_encode_chunks(encode_chunks);
+	writer.set_chunk_pool(pool.get());
+
+	if (!writer.write(archive_file_path)) {
+		fprintf(stderr, "[%s] failed to create archive '%s'\n", __func__, archive_file_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int handle_gen_arch_command(const std::string& archive_file_path, const util::archive_gen_params& params, size_t num_jobs) {
+	fprintf(stdout, "[%s] generating archive '%s' (%u files, seed %lu)\n", __func__, archive_file_path.c_str(), params.num_files, params.seed);
+
+	std::unique_ptr<util::thread_pool> pool((num_jobs > 1)? new util::thread_pool(num_jobs - 1): nullptr);
+	util::generate_archive(archive_file_path, params, pool.get());
+	return EXIT_SUCCESS;
+}
+
+static int handle_stress_arch_command(const std::string& archive_file_path, const util::archive_stress_params& params) {
+	// results go to stdout as a single line of JSON
+	return ((util::stress_archive(archive_file_path, params, stdout) == 0)? EXIT_SUCCESS: EXIT_FAILURE);
+}
+
+static int handle_bench_arch_command(const std::string& archive_file_path, const util::archive_bench_params& params) {
+	// results go to stdout as a single line of JSON
+	util::benchmark_archive(archive_file_path, params, stdout);
+	return EXIT_SUCCESS;
+}
+
+
+// removes "--<name> <value>" from the arguments following the command and returns <value>
+static const char* extract_option(int& argc, char** argv, const char* name) {
+	for (int i = 2; i < (argc - 1); ++i) {
+		if (strstr(argv[i], "--") != argv[i] || strcmp(argv[i] + 2, name) != 0)
+			continue;
+
+		const char* value = argv[i + 1];
+
+		std::copy(argv + i + 2, argv + argc, argv + i);
+		argc -= 2;
+		return value;
+	}
+
+	return nullptr;
+}
+
+static unsigned long extract_number_option(int& argc, char** argv, const char* name, unsigned long default_value) {
+	const char* value = extract_option(argc, argv, name);
+	return ((value != nullptr)? std::strtoul(value, nullptr, 0): default_value);
+}
+
+static int handle_command(int argc, char** argv, size_t num_jobs) {
+	if (strcmp(argv[1] + 2, "lf") == 0 || strcmp(argv[1] + 2, "list-files") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> [<pattern> ...]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_list_files_command(argv[2], std::vector<std::string>(argv + 3, argv + argc)));
+	}
+
+	if (strcmp(argv[1] + 2, "ef") == 0 || strcmp(argv[1] + 2, "extract-file") == 0) {
+		if (argc < 5) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> <source file> <target file> [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_extract_file_command(argv[2], argv[3], argv[4], num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "xf") == 0 || strcmp(argv[1] + 2, "extract-files") == 0) {
+		const char* list_file_path = extract_option(argc, argv, "from");
 
-			return (handle_list_files_command(argv[2]));
+		if (argc < 4 || (argc < 5 && list_file_path == nullptr)) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> <target directory> [<source file> ...] [--from <list file>] [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
 		}
 
-		if (strcmp(argv[1] + 2, "ef") == 0 || strcmp(argv[1] + 2, "extract-file") == 0) {
-			if (argc < 5) {
-				fprintf(stderr, "[%s] usage: %s <HPI archive> <source file> <target file>\n", __func__, argv[1]);
+		std::vector<std::string> src_file_paths(argv + 4, argv + argc);
+
+		if (list_file_path != nullptr) {
+			std::ifstream list_file_stream(list_file_path);
+
+			if (!list_file_stream.is_open()) {
+				fprintf(stderr, "[%s] failed to open list file '%s'\n", __func__, list_file_path);
 				return EXIT_FAILURE;
 			}
 
-			return (handle_extract_file_command(argv[2], argv[3], argv[4]));
+			// one source path per line
+			for (std::string line; std::getline(list_file_stream, line); ) {
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if (!line.empty())
+					src_file_paths.push_back(line);
+			}
+		}
+
+		return (handle_extract_files_command(argv[2], argv[3], src_file_paths, num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "ex") == 0 || strcmp(argv[1] + 2, "extract") == 0) {
+		if (argc < 5) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> <target directory> <pattern> [<pattern> ...] [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_extract_command(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc), num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "ea") == 0 || strcmp(argv[1] + 2, "extract-arch") == 0) {
+		if (argc < 4) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> <target directory> [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_extract_arch_command(argv[2], argv[3], num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "va") == 0 || strcmp(argv[1] + 2, "verify") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_verify_command(argv[2], num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "df") == 0 || strcmp(argv[1] + 2, "diff") == 0) {
+		util::archive_diff_params params;
+
+		params.trust_chunk_headers = extract_number_option(argc, argv, "trust-headers", params.trust_chunk_headers);
+
+		if (argc < 4) {
+			fprintf(stderr, "[%s] usage: %s <old HPI archive> <new HPI archive> [--trust-headers 0|1] [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_diff_command(argv[2], argv[3], params, num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "vl") == 0 || strcmp(argv[1] + 2, "vfs-list") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> [<HPI archive> ...]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_vfs_list_command(std::vector<std::string>(argv + 2, argv + argc)));
+	}
+
+	if (strcmp(argv[1] + 2, "ve") == 0 || strcmp(argv[1] + 2, "vfs-extract") == 0) {
+		if (argc < 4) {
+			fprintf(stderr, "[%s] usage: %s <target directory> <HPI archive> [<HPI archive> ...] [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
 		}
 
-		if (strcmp(argv[1] + 2, "ea") == 0 || strcmp(argv[1] + 2, "extract-arch") == 0) {
-			if (argc < 4) {
-				fprintf(stderr, "[%s] usage: %s <HPI archive> <target directory>\n", __func__, argv[1]);
+		return (handle_vfs_extract_command(std::vector<std::string>(argv + 3, argv + argc), argv[2], num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "ca") == 0 || strcmp(argv[1] + 2, "create-arch") == 0) {
+		const char* compression = extract_option(argc, argv, "compression");
+		const uint32_t header_key = extract_number_option(argc, argv, "key", 0);
+		const bool encode_chunks = extract_number_option(argc, argv, "encode", 0);
+
+		uint8_t compression_type = util::COMPRESSION_TYPE_ZLIB;
+
+		if (compression != nullptr) {
+			if (strcmp(compression, "null") == 0) {
+				compression_type = util::COMPRESSION_TYPE_NULL;
+			} else if (strcmp(compression, "lz77") == 0) {
+				compression_type = util::COMPRESSION_TYPE_LZ77;
+			} else if (strcmp(compression, "zlib") != 0) {
+				fprintf(stderr, "[%s] unknown compression \"%s\" (expected null, lz77 or zlib)\n", __func__, compression);
 				return EXIT_FAILURE;
 			}
+		}
+
+		if (argc < 4) {
+			fprintf(stderr, "[%s] usage: %s <source directory> <HPI archive> [--compression null|lz77|zlib] [--key K] [--encode 0|1] [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_create_arch_command(argv[2], argv[3], compression_type, header_key, encode_chunks, num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "ga") == 0 || strcmp(argv[1] + 2, "gen-arch") == 0) {
+		util::archive_gen_params params;
+
+		params.seed = extract_number_option(argc, argv, "seed", params.seed);
+		params.num_files = extract_number_option(argc, argv, "files", params.num_files);
+		params.tree_depth = extract_number_option(argc, argv, "depth", params.tree_depth);
+		params.min_file_size = extract_number_option(argc, argv, "min-size", params.min_file_size);
+		params.max_file_size = extract_number_option(argc, argv, "max-size", params.max_file_size);
+		params.header_key = extract_number_option(argc, argv, "key", params.header_key);
+		params.encode_chunks = extract_number_option(argc, argv, "encode", params.encode_chunks);
+
+		if (const char* mix = extract_option(argc, argv, "mix"); mix != nullptr) {
+			const std::vector<std::string> weights = util::str_split(mix, ",");
+
+			for (size_t i = 0; i < 3; ++i) {
+				params.compression_mix[i] = (i < weights.size())? std::strtoul(weights[i].c_str(), nullptr, 0): 0;
+			}
+		}
+
+		if (argc < 3) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> [--files N] [--depth N] [--min-size N] [--max-size N] [--mix null,lz77,zlib] [--key K] [--encode 0|1] [--seed S]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_gen_arch_command(argv[2], params, num_jobs));
+	}
+
+	if (strcmp(argv[1] + 2, "ba") == 0 || strcmp(argv[1] + 2, "bench-arch") == 0) {
+		util::archive_bench_params params;
+
+		params.num_opens = extract_number_option(argc, argv, "opens", params.num_opens);
+		params.num_lookups = extract_number_option(argc, argv, "lookups", params.num_lookups);
+		params.cache_budget = extract_number_option(argc, argv, "cache", params.cache_budget);
+		params.crypt_bytes = extract_number_option(argc, argv, "crypt-bytes", params.crypt_bytes);
+		params.cold_cache = extract_number_option(argc, argv, "cold-cache", params.cold_cache);
+
+		if (argc < 3) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> [--opens N] [--lookups N] [--cache BYTES] [--crypt-bytes N] [--cold-cache 0|1]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		return (handle_bench_arch_command(argv[2], params));
+	}
+
+	if (strcmp(argv[1] + 2, "sa") == 0 || strcmp(argv[1] + 2, "stress-arch") == 0) {
+		util::archive_stress_params params;
+
+		// one extracting thread per job
+		params.num_threads = num_jobs;
+		params.num_extracts = extract_number_option(argc, argv, "extracts", params.num_extracts);
+		params.num_pool_threads = extract_number_option(argc, argv, "pool-threads", params.num_pool_threads);
+
+		if (argc < 3) {
+			fprintf(stderr, "[%s] usage: %s <HPI archive> [--extracts N] [--pool-threads N] [--jobs N]\n", __func__, argv[1]);
+			return EXIT_FAILURE;
+		}
 
-			return (handle_extract_arch_command(argv[2], argv[3]));
+		return (handle_stress_arch_command(argv[2], params));
+	}
+
+	fprintf(stderr, "[%s] unhandled command \"%s\"\n", __func__, argv[1]);
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2 || strstr(argv[1], "--") != argv[1]) {
+		fprintf(stderr, "[%s] usage: %s <--list-files|--extract|--extract-file|--extract-files|--extract-arch|--verify|--diff|--vfs-list|--vfs-extract|--create-arch|--gen-arch|--bench-arch|--stress-arch> [--stats text|json] [--index-dir <directory>] [--queue-depth N]\n", __func__, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// default to one job per hardware core
+	const size_t num_jobs = extract_number_option(argc, argv, "jobs", std::thread::hardware_concurrency());
+	// counters are only collected if a report was asked for
+	const char* stats_format = extract_option(argc, argv, "stats");
+
+	if (const char* index_dir = extract_option(argc, argv, "index-dir"); index_dir != nullptr) {
+		archive_index_dir = index_dir;
+		fs::create_directories(archive_index_dir);
+	}
+
+	if ((archive_read_queue_depth = extract_number_option(argc, argv, "queue-depth", 0)) != 0)
+		fprintf(stderr, "[%s] reading %lu chunks ahead (%s)\n", __func__, archive_read_queue_depth, util::async_reader::get_backend_name());
+
+	int ret = EXIT_FAILURE;
+
+	if (stats_format != nullptr) {
+		if (strcmp(stats_format, "text") != 0 && strcmp(stats_format, "json") != 0) {
+			fprintf(stderr, "[%s] unknown stats format \"%s\" (expected text or json)\n", __func__, stats_format);
+			return EXIT_FAILURE;
 		}
 
-		fprintf(stderr, "[%s] unhandled command \"%s\"\n", __func__, argv[1]);
+		util::set_perf_stats_enabled(true);
+	}
+
+	try {
+		ret = handle_command(argc, argv, num_jobs);
 	} catch (const util::hpi_exception& e) {
 		fprintf(stderr, "[%s] exception \"%s\"\n", __func__, e.what());
 	}
 
-	return EXIT_FAILURE;
+	// stdout may carry command output (e.g. --bench-arch JSON), keep the report apart
+	if (stats_format != nullptr)
+		util::print_perf_stats(util::get_perf_stats(), stderr, strcmp(stats_format, "json") == 0);
+
+	return ret;
 }
 
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mmap_util.hpp"
+
+namespace util {
+	mapped_file& mapped_file::operator = (mapped_file&& m) noexcept {
+		if (this != &m) {
+			close();
+
+			map_addr = std::exchange(m.map_addr, nullptr);
+			map_size = std::exchange(m.map_size, 0);
+			file_desc = std::exchange(m.file_desc, -1);
+		}
+
+		return *this;
+	}
+
+	bool mapped_file::open(const std::string& file_path) {
+		close();
+
+		const int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (fd == -1)
+			return false;
+
+		struct stat sb;
+
+		// zero-sized files can not be mapped
+		if (fstat(fd, &sb) != 0 || sb.st_size <= 0) {
+			::close(fd);
+			return false;
+		}
+
+		void* addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (addr == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+
+		// default advice: lookups and ranges read at random, batches hint their own windows
+		map_addr = static_cast<const char*>(addr);
+		map_size = sb.st_size;
+		file_desc = fd;
+		return true;
+	}
+
+	void mapped_file::advise_willneed(size_t offset, size_t size) const {
+		if (map_addr == nullptr || offset >= map_size)
+			return;
+
+		// madvise wants a page-aligned start
+		const size_t page_size = sysconf(_SC_PAGESIZE);
+		const size_t page_offset = offset - (offset % page_size);
+
+		madvise(const_cast<char*>(map_addr) + page_offset, std::min(size + (offset - page_offset), map_size - page_offset), MADV_WILLNEED);
+	}
+
+	void mapped_file::close() {
+		if (map_addr == nullptr)
+			return;
+
+		munmap(const_cast<char*>(map_addr), map_size);
+		::close(file_desc);
+
+		map_addr = nullptr;
+		map_size = 0;
+		file_desc = -1;
+	}
+
+
+	pread_file& pread_file::operator = (pread_file&& f) noexcept {
+		if (this != &f) {
+			close();
+
+			file_desc = std::exchange(f.file_desc, -1);
+		}
+
+		return *this;
+	}
+
+	bool pread_file::open(const std::string& file_path) {
+		close();
+
+		return ((file_desc = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC)) != -1);
+	}
+
+	void pread_file::close() {
+		if (file_desc == -1)
+			return;
+
+		::close(file_desc);
+
+		file_desc = -1;
+	}
+
+	void pread_file::advise_willneed(size_t offset, size_t size) const {
+		if (file_desc == -1)
+			return;
+
+		posix_fadvise(file_desc, offset, size, POSIX_FADV_WILLNEED);
+	}
+
+	size_t pread_file::read(size_t offset, char* buffer, size_t size) const {
+		size_t num_read = 0;
+
+		while (num_read < size) {
+			const ssize_t n = pread(file_desc, buffer + num_read, size - num_read, offset + num_read);
+
+			if (n > 0) {
+				num_read += n;
+				continue;
+			}
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		return num_read;
+	}
+
+
+	size_t copy_file_data(int src_fd, size_t src_offset, int dst_fd, size_t size) {
+		size_t num_copied = 0;
+		// copy_file_range can share extents or copy inside the file system, sendfile at least
+		// stays in the kernel; older kernels refuse the former across file systems
+		bool use_copy_range = true;
+
+		while (num_copied < size) {
+			off_t offset = src_offset + num_copied;
+			ssize_t n = 0;
+
+			if (use_copy_range) {
+				n = copy_file_range(src_fd, &offset, dst_fd, nullptr, size - num_copied, 0);
+			} else {
+				n = sendfile(dst_fd, src_fd, &offset, size - num_copied);
+			}
+
+			if (n > 0) {
+				num_copied += n;
+				continue;
+			}
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n < 0 && use_copy_range && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+				use_copy_range = false;
+				continue;
+			}
+
+			// EOF or neither call works on these descriptors
+			break;
+		}
+
+		return num_copied;
+	}
+}
+
@@ -0,0 +1,77 @@
+#ifndef HAPINESS_MMAP_UTIL_HDR
+#define HAPINESS_MMAP_UTIL_HDR
+
+#include <cstddef>
+#include <string>
+
+namespace util {
+	// read-only memory-mapping of an entire file
+	class mapped_file {
+	public:
+		mapped_file() = default;
+		mapped_file(const mapped_file&) = delete;
+		mapped_file(mapped_file&& m) noexcept { *this = std::move(m); }
+		~mapped_file() { close(); }
+
+		mapped_file& operator = (const mapped_file&) = delete;
+		mapped_file& operator = (mapped_file&& m) noexcept;
+
+		bool open(const std::string& file_path);
+		void close();
+
+		bool is_open() const { return (map_addr != nullptr); }
+
+		// kept open alongside the mapping for kernel-side copies
+		int get_file_desc() const { return file_desc; }
+
+		const char* data() const { return map_addr; }
+		size_t size() const { return map_size; }
+
+		// hints that [offset, offset + size) will be read soon
+		void advise_willneed(size_t offset, size_t size) const;
+
+	private:
+		const char* map_addr = nullptr;
+		size_t map_size = 0;
+
+		int file_desc = -1;
+	};
+
+
+	// file read through positional (pread) calls, safe to share between threads
+	class pread_file {
+	public:
+		pread_file() = default;
+		pread_file(const pread_file&) = delete;
+		pread_file(pread_file&& f) noexcept { *this = std::move(f); }
+		~pread_file() { close(); }
+
+		pread_file& operator = (const pread_file&) = delete;
+		pread_file& operator = (pread_file&& f) noexcept;
+
+		bool open(const std::string& file_path);
+		void close();
+
+		bool is_open() const { return (file_desc != -1); }
+
+		int get_file_desc() const { return file_desc; }
+
+		// returns the number of bytes read, which is less than <size> only at EOF or on error
+		size_t read(size_t offset, char* buffer, size_t size) const;
+
+		// hints that [offset, offset + size) will be read soon
+		void advise_willneed(size_t offset, size_t size) const;
+
+	private:
+		int file_desc = -1;
+	};
+
+
+	// copies [src_offset, src_offset + size) of <src_fd> to the current position of <dst_fd>
+	// without passing the data through user space; returns the number of bytes copied, which
+	// is less than <size> if neither copy_file_range nor sendfile can handle the descriptors
+	size_t copy_file_data(int src_fd, size_t src_offset, int dst_fd, size_t size);
+}
+
+#endif
+
@@ -0,0 +1,53 @@
+#ifndef HAPINESS_SCRATCH_UTIL_HDR
+#define HAPINESS_SCRATCH_UTIL_HDR
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "stats_util.hpp"
+
+namespace util {
+	// default-initializes instead of value-initializing, so resizing a vector of trivial
+	// elements leaves the new elements uninitialized rather than zero-filling them
+	template<typename T, typename A = std::allocator<T>>
+	class default_init_allocator: public A {
+	public:
+		template<typename U>
+		struct rebind {
+			using other = default_init_allocator<U, typename std::allocator_traits<A>::template rebind_alloc<U>>;
+		};
+
+		using A::A;
+
+		template<typename U>
+		void construct(U* ptr) noexcept(std::is_nothrow_default_constructible<U>::value) {
+			::new (static_cast<void*>(ptr)) U;
+		}
+		template<typename U, typename... Args>
+		void construct(U* ptr, Args&&... args) {
+			std::allocator_traits<A>::construct(static_cast<A&>(*this), ptr, std::forward<Args>(args)...);
+		}
+	};
+
+	// holds data that is always written before it is read
+	typedef std::vector<char, default_init_allocator<char>> scratch_buffer;
+
+
+	// resizes <buffer> to <size> without filling it; only counts as an allocation (see
+	// PERF_COUNTER_SCRATCH_ALLOCS) if the buffer has to grow, which a reused buffer
+	// stops doing once it has seen the largest size
+	template<typename T>
+	T* resize_scratch_buffer(std::vector<T, default_init_allocator<T>>& buffer, size_t size) {
+		if (size > buffer.capacity())
+			add_perf_counter(PERF_COUNTER_SCRATCH_ALLOCS, 1);
+
+		buffer.resize(size);
+		return (buffer.data());
+	}
+}
+
+#endif
+
@@ -0,0 +1,80 @@
+#include "stats_util.hpp"
+
+namespace util {
+	static const char* perf_counter_names[PERF_COUNTER_COUNT] = {
+		"opens",
+		"open_ns",
+		"reads",
+		"read_bytes",
+		"decrypt_ns",
+		"decrypt_bytes",
+		"checksum_ns",
+		"checksum_bytes",
+		"decode_ns",
+		"decode_bytes",
+		"lz77_ns",
+		"lz77_bytes",
+		"zlib_ns",
+		"zlib_bytes",
+		"chunks",
+		"files",
+		"scratch_allocs",
+	};
+
+
+	perf_stats get_perf_stats() {
+		perf_stats stats;
+
+		for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+			stats.counters[i] = perf_counters[i].load(std::memory_order_relaxed);
+		}
+
+		return stats;
+	}
+
+	void reset_perf_stats() {
+		for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+			perf_counters[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	const char* perf_counter_name(perf_counter_type type) {
+		return ((type < PERF_COUNTER_COUNT)? perf_counter_names[type]: "????");
+	}
+
+
+	void print_perf_stats(const perf_stats& stats, FILE* out, bool json) {
+		if (json) {
+			for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+				fprintf(out, "%s\"%s\": %lu", ((i == 0)? "{": ", "), perf_counter_names[i], stats.counters[i]);
+			}
+
+			fprintf(out, "}\n");
+			return;
+		}
+
+		// pairs a time with the number of bytes processed in it
+		const auto print_stage = [&](const char* name, perf_counter_type ns_type, perf_counter_type bytes_type) {
+			const double ms = stats[ns_type] * 1e-6;
+			const double mb = stats[bytes_type] / (1024.0 * 1024.0);
+
+			fprintf(out, "\t%-10s %10.2f ms %12.2f MB %10.2f MB/s\n", name, ms, mb, ((ms > 0.0)? (mb * 1e3 / ms): 0.0));
+		};
+
+		fprintf(out, "[%s]\n", __func__);
+		fprintf(out, "\t%-10s %10.2f ms %12lu opens\n", "open", stats[PERF_COUNTER_OPEN_NS] * 1e-6, stats[PERF_COUNTER_OPENS]);
+		fprintf(out, "\t%-10s %13s %12.2f MB %10lu reads\n", "read", "", stats[PERF_COUNTER_READ_BYTES] / (1024.0 * 1024.0), stats[PERF_COUNTER_READS]);
+
+		print_stage("decrypt", PERF_COUNTER_DECRYPT_NS, PERF_COUNTER_DECRYPT_BYTES);
+		print_stage("checksum", PERF_COUNTER_CHECKSUM_NS, PERF_COUNTER_CHECKSUM_BYTES);
+		print_stage("decode", PERF_COUNTER_DECODE_NS, PERF_COUNTER_DECODE_BYTES);
+		print_stage("lz77", PERF_COUNTER_LZ77_NS, PERF_COUNTER_LZ77_BYTES);
+		print_stage("zlib", PERF_COUNTER_ZLIB_NS, PERF_COUNTER_ZLIB_BYTES);
+
+		fprintf(out, "\t%-10s %lu\n", "chunks", stats[PERF_COUNTER_CHUNKS]);
+		fprintf(out, "\t%-10s %lu\n", "files", stats[PERF_COUNTER_FILES]);
+		// heap allocations of extraction scratch buffers, zero per file once they are warm
+		fprintf(out, "\t%-10s %lu\n", "allocs", stats[PERF_COUNTER_SCRATCH_ALLOCS]);
+	}
+}
+
@@ -0,0 +1,89 @@
+#ifndef HAPINESS_STATS_UTIL_HDR
+#define HAPINESS_STATS_UTIL_HDR
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace util {
+	enum perf_counter_type {
+		PERF_COUNTER_OPENS          =  0,
+		PERF_COUNTER_OPEN_NS        =  1,
+		PERF_COUNTER_READS          =  2,
+		PERF_COUNTER_READ_BYTES     =  3,
+		PERF_COUNTER_DECRYPT_NS     =  4,
+		PERF_COUNTER_DECRYPT_BYTES  =  5,
+		PERF_COUNTER_CHECKSUM_NS    =  6,
+		PERF_COUNTER_CHECKSUM_BYTES =  7,
+		PERF_COUNTER_DECODE_NS      =  8,
+		PERF_COUNTER_DECODE_BYTES   =  9,
+		PERF_COUNTER_LZ77_NS        = 10,
+		PERF_COUNTER_LZ77_BYTES     = 11,
+		PERF_COUNTER_ZLIB_NS        = 12,
+		PERF_COUNTER_ZLIB_BYTES     = 13,
+		PERF_COUNTER_CHUNKS         = 14,
+		PERF_COUNTER_FILES          = 15,
+		PERF_COUNTER_SCRATCH_ALLOCS = 16,
+		PERF_COUNTER_COUNT          = 17,
+	};
+
+	// snapshot of all counters; times are in nanoseconds (summed over threads) and
+	// decompression byte counts refer to output bytes
+	struct perf_stats {
+		uint64_t counters[PERF_COUNTER_COUNT] = {};
+
+		uint64_t operator [] (perf_counter_type type) const { return counters[type]; }
+	};
+
+
+	// process-wide, updated with relaxed atomics; disabled (the default) costs one load per update
+	inline std::atomic<bool> perf_stats_enabled = {false};
+	inline std::atomic<uint64_t> perf_counters[PERF_COUNTER_COUNT] = {};
+
+	inline bool is_perf_stats_enabled() { return (perf_stats_enabled.load(std::memory_order_relaxed)); }
+	inline void set_perf_stats_enabled(bool enabled) { perf_stats_enabled.store(enabled, std::memory_order_relaxed); }
+
+	inline void add_perf_counter(perf_counter_type type, uint64_t value) {
+		if (!is_perf_stats_enabled())
+			return;
+
+		perf_counters[type].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	perf_stats get_perf_stats();
+	void reset_perf_stats();
+
+	const char* perf_counter_name(perf_counter_type type);
+	// one counter per line, or a single JSON object (on one line) if <json> is set
+	void print_perf_stats(const perf_stats& stats, FILE* out, bool json);
+
+
+	// adds the time between construction and destruction to a *_NS counter; the clock
+	// is not read at all if stats were disabled on construction
+	class perf_timer {
+	public:
+		perf_timer(perf_counter_type type): counter_type(type), enabled(is_perf_stats_enabled()) {
+			if (enabled)
+				start_time = std::chrono::steady_clock::now();
+		}
+		perf_timer(const perf_timer&) = delete;
+		~perf_timer() {
+			if (!enabled)
+				return;
+
+			perf_counters[counter_type].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count(), std::memory_order_relaxed);
+		}
+
+		perf_timer& operator = (const perf_timer&) = delete;
+
+	private:
+		perf_counter_type counter_type;
+		bool enabled;
+
+		std::chrono::steady_clock::time_point start_time;
+	};
+}
+
+#endif
+
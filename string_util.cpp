@@ -35,6 +35,97 @@ namespace util {
 		return copy;
 	}
 
+	// equivalent to std::toupper in the (default) "C" locale, minus the call overhead
+	static uint8_t char_to_uppercase(uint8_t c) {
+		return (c - ((c >= 'a' && c <= 'z') * ('a' - 'A')));
+	}
+
+	int str_compare_nocase(std::string_view a, std::string_view b) {
+		for (size_t i = 0, n = std::min(a.size(), b.size()); i < n; ++i) {
+			const uint8_t ca = char_to_uppercase(a[i]);
+			const uint8_t cb = char_to_uppercase(b[i]);
+
+			if (ca != cb)
+				return ((ca < cb)? -1: 1);
+		}
+
+		return ((a.size() < b.size())? -1: (a.size() > b.size()));
+	}
+
+	void str_fold_case(std::string_view str, std::string& out) {
+		out.resize(str.size());
+
+		for (size_t i = 0; i < str.size(); ++i) {
+			out[i] = char_to_uppercase(str[i]);
+		}
+	}
+
+	bool str_match_glob(std::string_view pattern, std::string_view str) {
+		// a failed match only ever backtracks to the last star, letting it take one more
+		// character; earlier stars could only shift the rest along positions that one has
+		// already tried, except that a '*' can not take a '/' where an earlier '**' can
+		size_t pattern_pos = 0;
+		size_t str_pos = 0;
+
+		// pattern positions right past the last star and the last '**', and where in <str>
+		// their matches currently end
+		size_t star_pattern_pos = std::string_view::npos;
+		size_t star_str_pos = 0;
+		size_t any_star_pattern_pos = std::string_view::npos;
+		size_t any_star_str_pos = 0;
+
+		bool any_depth_star = false;
+
+		while (str_pos < str.size()) {
+			if (pattern_pos < pattern.size() && pattern[pattern_pos] == '*') {
+				any_depth_star = (pattern_pos + 1) < pattern.size() && pattern[pattern_pos + 1] == '*';
+				pattern_pos += (1 + any_depth_star);
+
+				star_pattern_pos = pattern_pos;
+				star_str_pos = str_pos;
+
+				if (any_depth_star) {
+					any_star_pattern_pos = pattern_pos;
+					any_star_str_pos = str_pos;
+				}
+
+				continue;
+			}
+
+			if (pattern_pos < pattern.size() && ((pattern[pattern_pos] == '?')? (str[str_pos] != '/'): (pattern[pattern_pos] == str[str_pos]))) {
+				pattern_pos += 1;
+				str_pos += 1;
+				continue;
+			}
+
+			if (star_pattern_pos != std::string_view::npos && (any_depth_star || str[star_str_pos] != '/')) {
+				pattern_pos = star_pattern_pos;
+				str_pos = ++star_str_pos;
+				continue;
+			}
+
+			if (any_star_pattern_pos != std::string_view::npos) {
+				pattern_pos = star_pattern_pos = any_star_pattern_pos;
+				str_pos = star_str_pos = ++any_star_str_pos;
+				any_depth_star = true;
+				continue;
+			}
+
+			return false;
+		}
+
+		// stars left at the end of the pattern match nothing
+		while (pattern_pos < pattern.size() && pattern[pattern_pos] == '*') {
+			pattern_pos += 1;
+		}
+
+		return (pattern_pos == pattern.size());
+	}
+
+	size_t str_glob_prefix_size(std::string_view pattern) {
+		return (std::min(pattern.find_first_of("*?"), pattern.size()));
+	}
+
 	std::string str_latin1_to_utf8(const std::string& str) {
 		std::string output;
 
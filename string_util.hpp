@@ -2,6 +2,7 @@
 #define HAPINESS_STRING_UTIL_HDR
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace util {
@@ -10,6 +11,18 @@ namespace util {
 
 	std::string str_to_uppercase(const std::string& str);
 
+	// case-insensitive three-way comparison, matches str_to_uppercase(a) <=> str_to_uppercase(b)
+	int str_compare_nocase(std::string_view a, std::string_view b);
+	// upper-cases <str> into <out> like str_compare_nocase, reusing the storage of <out>
+	void str_fold_case(std::string_view str, std::string& out);
+
+	// shell-style match of all of <str> against <pattern>, where '?' matches any character
+	// but '/', '*' any run of them and '**' any run of characters including '/'
+	// note: case-sensitive, fold both sides for case-insensitive matching
+	bool str_match_glob(std::string_view pattern, std::string_view str);
+	// length of the part of <pattern> before its first wildcard
+	size_t str_glob_prefix_size(std::string_view pattern);
+
 	std::string str_latin1_to_utf8(const std::string& str);
 
 	size_t str_size(const char* begin, const char* end);
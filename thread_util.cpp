@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#include "thread_util.hpp"
+
+namespace util {
+	thread_pool::thread_pool(size_t num_threads) {
+		if (num_threads == 0)
+			num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+		threads.reserve(num_threads);
+
+		for (size_t i = 0; i < num_threads; ++i) {
+			threads.emplace_back(&thread_pool::run_worker, this);
+		}
+	}
+
+	thread_pool::~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(task_mutex);
+			shutdown = true;
+		}
+
+		task_cond.notify_all();
+
+		for (std::thread& t: threads) {
+			t.join();
+		}
+	}
+
+
+	void thread_pool::run_worker() {
+		while (true) {
+			std::shared_ptr<loop_func> loop;
+
+			{
+				std::unique_lock<std::mutex> lock(task_mutex);
+				task_cond.wait(lock, [this]() { return (shutdown || !open_loops.empty()); });
+
+				if (open_loops.empty())
+					return;
+
+				// an outer loop's indices go before those of the loops nested in its tasks
+				loop = open_loops.front();
+			}
+
+			// returns once the loop has no indices left, though its last ones may still run
+			(*loop)();
+			close_loop(loop);
+		}
+	}
+
+	void thread_pool::close_loop(const std::shared_ptr<loop_func>& loop) {
+		const std::lock_guard<std::mutex> lock(task_mutex);
+		const auto iter = std::find(open_loops.begin(), open_loops.end(), loop);
+
+		if (iter != open_loops.end())
+			open_loops.erase(iter);
+	}
+
+
+	void thread_pool::parallel_for(size_t n, const std::function<void(size_t)>& func) {
+		struct loop_state {
+			std::atomic<size_t> next_index = {0};
+			std::atomic<bool> cancelled = {false};
+
+			std::mutex done_mutex;
+			std::condition_variable done_cond;
+
+			size_t num_done = 0;
+			std::exception_ptr error;
+		};
+
+		if (n == 0)
+			return;
+
+		// shared with workers that might only leave the loop after we return
+		const std::shared_ptr<loop_state> state = std::make_shared<loop_state>();
+
+		const auto run_loop = [state, n, &func]() {
+			size_t num_done = 0;
+
+			for (size_t i; (i = state->next_index.fetch_add(1)) < n; ++num_done) {
+				if (state->cancelled)
+					continue;
+
+				try {
+					func(i);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(state->done_mutex);
+
+					if (!state->error)
+						state->error = std::current_exception();
+
+					state->cancelled = true;
+				}
+			}
+
+			if (num_done == 0)
+				return;
+
+			std::lock_guard<std::mutex> lock(state->done_mutex);
+
+			if ((state->num_done += num_done) == n)
+				state->done_cond.notify_all();
+		};
+
+		// nothing to share
+		if (n == 1 || threads.empty()) {
+			run_loop();
+		} else {
+			const std::shared_ptr<loop_func> loop = std::make_shared<loop_func>(run_loop);
+
+			{
+				std::lock_guard<std::mutex> lock(task_mutex);
+				open_loops.push_back(loop);
+			}
+
+			task_cond.notify_all();
+			run_loop();
+			close_loop(loop);
+		}
+
+		std::unique_lock<std::mutex> lock(state->done_mutex);
+		state->done_cond.wait(lock, [&]() { return (state->num_done == n); });
+
+		if (state->error)
+			std::rethrow_exception(state->error);
+	}
+}
+
@@ -0,0 +1,50 @@
+#ifndef HAPINESS_THREAD_UTIL_HDR
+#define HAPINESS_THREAD_UTIL_HDR
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+	class thread_pool {
+	public:
+		// zero means one thread per hardware core
+		thread_pool(size_t num_threads = 0);
+		thread_pool(const thread_pool&) = delete;
+		~thread_pool();
+
+		thread_pool& operator = (const thread_pool&) = delete;
+
+		size_t size() const { return threads.size(); }
+
+		// calls func(i) for every i in [0, n) and returns when all calls are done; the
+		// calling thread also processes indices, so this may be nested inside a task
+		// note: idle workers join the oldest loop that still has indices left, so a loop
+		// nested in another one's task is helped by the workers that loop has run out of
+		// indices for, and only by those
+		// note: rethrows the first exception raised by <func> after stopping early
+		void parallel_for(size_t n, const std::function<void(size_t)>& func);
+
+	private:
+		typedef std::function<void()> loop_func;
+
+		void run_worker();
+		void close_loop(const std::shared_ptr<loop_func>& loop);
+
+	private:
+		std::vector<std::thread> threads;
+		// each runs indices of its parallel_for until none are left, oldest first
+		std::vector<std::shared_ptr<loop_func>> open_loops;
+
+		std::mutex task_mutex;
+		std::condition_variable task_cond;
+
+		bool shutdown = false;
+	};
+}
+
+#endif
+
@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <utility>
+
+#include "vfs_util.hpp"
+#include "string_util.hpp"
+#include "thread_util.hpp"
+
+namespace util {
+	typedef std::vector<std::pair<std::string, const hpi_archive::file_data*>> archive_file_list;
+
+	static void collect_archive_files(const hpi_archive& archive, const hpi_archive::entry_list& entries, std::string& path, archive_file_list& files) {
+		const size_t path_size = path.size();
+
+		for (const hpi_archive::arch_entry& entry: entries) {
+			path.append(entry.name);
+
+			if (const hpi_archive::path_data* d = boost::get<hpi_archive::path_data>(&entry.data); d != nullptr) {
+				path.push_back('/');
+				collect_archive_files(archive, archive.get_entries(*d), path, files);
+			} else {
+				files.emplace_back(path, &boost::get<hpi_archive::file_data>(entry.data));
+			}
+
+			path.resize(path_size);
+		}
+	}
+
+
+	void hpi_vfs::mount(const std::vector<std::string>& new_archive_paths, thread_pool* pool) {
+		std::vector<std::unique_ptr<hpi_archive>> new_archives(new_archive_paths.size());
+		std::vector<archive_file_list> new_files(new_archive_paths.size());
+
+		// opening and walking each archive is independent, only merging is ordered
+		const auto open_archive = [&](size_t i) {
+			std::string path;
+			std::unique_ptr<hpi_archive> archive = std::make_unique<hpi_archive>();
+
+			if (!archive->open(new_archive_paths[i]))
+				return;
+
+			collect_archive_files(*archive, archive->get_root_entries(), path, new_files[i]);
+			new_archives[i] = std::move(archive);
+		};
+
+		if (pool != nullptr) {
+			pool->parallel_for(new_archive_paths.size(), open_archive);
+		} else {
+			for (size_t i = 0; i < new_archive_paths.size(); ++i) {
+				open_archive(i);
+			}
+		}
+
+		for (size_t i = 0; i < new_archive_paths.size(); ++i) {
+			if (new_archives[i] != nullptr)
+				continue;
+
+			char error[256];
+			snprintf(error, sizeof(error) - 1, "[%s] failed to open archive '%s'", __func__, new_archive_paths[i].c_str());
+			throw hpi_exception(error);
+		}
+
+		std::string key;
+
+		for (size_t i = 0; i < new_archive_paths.size(); ++i) {
+			const uint32_t archive_index = archives.size();
+
+			for (auto& [path, file]: new_files[i]) {
+				str_fold_case(path, key);
+
+				if (const auto [iter, inserted] = file_index.try_emplace(key, files.size()); !inserted) {
+					files[iter->second] = {std::move(path), archive_index, file};
+				} else {
+					files.push_back({std::move(path), archive_index, file});
+				}
+			}
+
+			archives.push_back(std::move(new_archives[i]));
+			archive_paths.push_back(new_archive_paths[i]);
+		}
+	}
+
+
+	#ifdef USE_STD_OPTIONAL
+	std::optional<std::reference_wrapper<const hpi_vfs::vfs_file>>
+	#else
+	const hpi_vfs::vfs_file*
+	#endif
+	hpi_vfs::find_file(std::string_view path) const {
+		// folded key buffer is reused, lookups do not allocate once warmed up
+		thread_local std::string key;
+
+		str_fold_case(path, key);
+
+		const auto iter = file_index.find(key);
+
+		#ifdef USE_STD_OPTIONAL
+		if (iter == file_index.end())
+			return std::nullopt;
+
+		return files[iter->second];
+		#else
+		return ((iter != file_index.end())? &files[iter->second]: nullptr);
+		#endif
+	}
+}
+
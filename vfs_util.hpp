@@ -0,0 +1,71 @@
+#ifndef HAPINESS_VFS_UTIL_HDR
+#define HAPINESS_VFS_UTIL_HDR
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "archive_util.hpp"
+
+namespace util {
+	class thread_pool;
+
+	// merged view of several archives; a file in a later mounted archive overrides the
+	// file with the same (case-insensitive) path in all earlier ones
+	class hpi_vfs {
+	public:
+		struct vfs_file {
+			// full path as spelled in the winning archive
+			std::string path;
+
+			uint32_t archive_index = 0;
+
+			const hpi_archive::file_data* file = nullptr;
+		};
+
+	public:
+		hpi_vfs() = default;
+		hpi_vfs(const hpi_vfs&) = delete;
+
+		hpi_vfs& operator = (const hpi_vfs&) = delete;
+
+		// opens <archive_paths> (in parallel on <pool> if set) and merges them into the index
+		// in the given order, taking precedence over all previously mounted archives
+		// note: throws hpi_exception if any archive can not be opened, nothing is mounted then
+		// note: invalidates references to files returned before
+		void mount(const std::vector<std::string>& archive_paths, thread_pool* pool = nullptr);
+
+		// one hash probe regardless of the number of mounted archives
+		#ifdef USE_STD_OPTIONAL
+		std::optional<std::reference_wrapper<const vfs_file>> find_file(std::string_view path) const;
+		#else
+		const vfs_file* find_file(std::string_view path) const;
+		#endif
+
+		// winning file of every path, in order of first appearance
+		const std::vector<vfs_file>& get_files() const { return files; }
+
+		size_t get_num_archives() const { return archives.size(); }
+
+		const hpi_archive& get_archive(size_t i) const { return *archives[i]; }
+		const std::string& get_archive_path(size_t i) const { return archive_paths[i]; }
+
+		// note: extraction is thread-safe, see hpi_archive
+		bool extract(const vfs_file& file, std::vector<char>& buffer) const { return (archives[file.archive_index]->extract(*file.file, buffer)); }
+		bool extract(const vfs_file& file, const hpi_archive::extract_sink& sink) const { return (archives[file.archive_index]->extract(*file.file, sink)); }
+
+	private:
+		// archives are never moved so file_data pointers into them stay valid
+		std::vector<std::unique_ptr<hpi_archive>> archives;
+		std::vector<std::string> archive_paths;
+
+		std::vector<vfs_file> files;
+		// case-folded path to index into <files>
+		std::unordered_map<std::string, uint32_t> file_index;
+	};
+}
+
+#endif
+
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "writer_util.hpp"
+#include "archive_util.hpp"
+#include "compress_util.hpp"
+#include "crypt_util.hpp"
+#include "string_util.hpp"
+#include "thread_util.hpp"
+
+namespace util {
+	// files loaded (and compressed) at once per pool thread
+	static constexpr size_t WRITE_BATCH_FILES = 16;
+
+
+	static size_t alloc_directory_space(std::vector<char>& dir_buffer, size_t size) {
+		const size_t offset = dir_buffer.size();
+
+		dir_buffer.resize(offset + size, 0);
+		return offset;
+	}
+
+	// compresses one chunk into <packed_chunk> (header followed by payload); chunks that do not shrink are stored
+	static void pack_chunk(const char* data, size_t size, uint8_t compression_type, bool encode, std::vector<char>& packed_chunk) {
+		char* payload = nullptr;
+
+		hpi_chunk chunk_header;
+		chunk_header.magic = HPI_CHUNK_MAGIC_NUMBER;
+		chunk_header.version = 2;
+		chunk_header.compression_type = compression_type;
+		chunk_header.encoded = encode;
+		chunk_header.decompressed_size = size;
+
+		size_t packed_size = 0;
+
+		switch (compression_type) {
+			case COMPRESSION_TYPE_LZ77: {
+				packed_chunk.resize(sizeof(chunk_header) + compress_lz77_bound(size));
+				packed_size = compress_lz77(data, size, payload = packed_chunk.data() + sizeof(chunk_header));
+			} break;
+			case COMPRESSION_TYPE_ZLIB: {
+				packed_chunk.resize(sizeof(chunk_header) + compress_zlib_bound(size));
+				packed_size = compress_zlib(data, size, payload = packed_chunk.data() + sizeof(chunk_header), packed_chunk.size() - sizeof(chunk_header));
+			} break;
+			default: {
+			} break;
+		}
+
+		if (payload == nullptr || packed_size >= size) {
+			packed_chunk.resize(sizeof(chunk_header) + size);
+			std::memcpy(payload = packed_chunk.data() + sizeof(chunk_header), data, size);
+
+			packed_size = size;
+			chunk_header.compression_type = COMPRESSION_TYPE_NULL;
+		}
+
+		// inverse of the (b - i) ^ i decoding
+		for (size_t i = 0; i < packed_size && encode; ++i) {
+			payload[i] = static_cast<uint8_t>((payload[i] ^ i) + i);
+		}
+
+		chunk_header.compressed_size = packed_size;
+		chunk_header.checksum = compute_buffer_checksum(payload, packed_size);
+
+		packed_chunk.resize(sizeof(chunk_header) + packed_size);
+		std::memcpy(packed_chunk.data(), &chunk_header, sizeof(chunk_header));
+	}
+
+	// XOR-ing is its own inverse, so decryption doubles as encryption
+	static void encrypt_buffer(uint8_t key, size_t offset, char* buffer, size_t size) {
+		if (key == 0)
+			return;
+
+		decrypt_buffer(key, offset, buffer, buffer, size);
+	}
+
+
+	hpi_archive_writer::hpi_archive_writer(): nodes(1) {
+	}
+
+	uint32_t hpi_archive_writer::add_node(std::string_view path, uint32_t file_index) {
+		uint32_t node_index = 0;
+
+		char error[256];
+
+		while (!path.empty()) {
+			const size_t sep_pos = path.find('/');
+			const std::string_view name = path.substr(0, sep_pos);
+
+			path = (sep_pos == std::string_view::npos)? std::string_view(): path.substr(sep_pos + 1);
+
+			// skip empty components ("a//b", "/a", "a/")
+			if (name.empty())
+				continue;
+
+			const bool is_leaf = (path.find_first_not_of('/') == std::string_view::npos);
+			const std::string key = str_to_uppercase(std::string(name));
+
+			if (const auto iter = nodes[node_index].child_names.find(key); iter != nodes[node_index].child_names.end()) {
+				const bool is_path = (nodes[iter->second].file_index == uint32_t(-1));
+
+				if (!is_path || (is_leaf && file_index != uint32_t(-1))) {
+					snprintf(error, sizeof(error) - 1, "[%s] entry '%s' already exists", __func__, std::string(name).c_str());
+					throw hpi_exception(error);
+					return 0;
+				}
+
+				node_index = iter->second;
+				continue;
+			}
+
+			const uint32_t child_index = nodes.size();
+
+			nodes.emplace_back();
+			nodes.back().name = name;
+			nodes.back().file_index = is_leaf? file_index: uint32_t(-1);
+
+			nodes[node_index].children.push_back(child_index);
+			nodes[node_index].child_names.emplace(key, child_index);
+
+			node_index = child_index;
+		}
+
+		if (node_index == 0 && file_index != uint32_t(-1)) {
+			snprintf(error, sizeof(error) - 1, "[%s] empty file path", __func__);
+			throw hpi_exception(error);
+			return 0;
+		}
+
+		return node_index;
+	}
+
+	void hpi_archive_writer::add_path(std::string_view path) {
+		add_node(path, -1);
+	}
+
+	void hpi_archive_writer::add_file(std::string_view path, uint8_t compression_type, const file_source& source) {
+		char error[256];
+
+		if (compression_type > COMPRESSION_TYPE_ZLIB) {
+			snprintf(error, sizeof(error) - 1, "[%s] invalid compression type %u", __func__, compression_type);
+			throw hpi_exception(error);
+			return;
+		}
+
+		add_node(path, files.size());
+		files.push_back({source, compression_type});
+	}
+
+	void hpi_archive_writer::add_file(std::string_view path, uint8_t compression_type, std::vector<char> data) {
+		add_file(path, compression_type, [data = std::move(data)](std::vector<char>& out) { out = data; });
+	}
+
+
+	// appends the entry list of <node_index> and everything below it, fills in the hpi_path_data at <path_offset>
+	void hpi_archive_writer::layout_directory(uint32_t node_index, size_t path_offset, std::vector<char>& dir_buffer, std::vector<size_t>& file_data_offsets) const {
+		const path_node& node = nodes[node_index];
+
+		hpi_path_data path;
+		path.number_of_entries = node.children.size();
+		path.entry_list_offset = alloc_directory_space(dir_buffer, path.number_of_entries * sizeof(hpi_arch_entry));
+
+		std::memcpy(dir_buffer.data() + path_offset, &path, sizeof(path));
+
+		for (size_t i = 0; i < node.children.size(); ++i) {
+			const path_node& child = nodes[node.children[i]];
+			const bool is_path = (child.file_index == uint32_t(-1));
+
+			hpi_arch_entry entry;
+			entry.name_offset = alloc_directory_space(dir_buffer, child.name.size() + 1);
+			entry.data_offset = alloc_directory_space(dir_buffer, is_path? sizeof(hpi_path_data): sizeof(hpi_file_data));
+			entry.is_path = is_path;
+
+			std::memcpy(dir_buffer.data() + entry.name_offset, child.name.data(), child.name.size());
+			std::memcpy(dir_buffer.data() + path.entry_list_offset + i * sizeof(entry), &entry, sizeof(entry));
+
+			if (is_path) {
+				layout_directory(node.children[i], entry.data_offset, dir_buffer, file_data_offsets);
+			} else {
+				file_data_offsets[child.file_index] = entry.data_offset;
+			}
+		}
+	}
+
+	bool hpi_archive_writer::write(const std::string& file_path) const {
+		const uint8_t key = (static_cast<uint8_t>(header_key) << 2) | (static_cast<uint8_t>(header_key) >> 6);
+		const size_t dir_start = sizeof(hpi_version) + sizeof(hpi_header);
+
+		std::vector<char> dir_buffer(dir_start + sizeof(hpi_path_data), 0);
+		std::vector<size_t> file_data_offsets(files.size(), 0);
+
+		layout_directory(0, dir_start, dir_buffer, file_data_offsets);
+
+		std::ofstream stream(file_path, std::ios::binary);
+
+		if (!stream.is_open())
+			return false;
+
+		const auto run_tasks = [&](size_t n, const std::function<void(size_t)>& func) {
+			if (chunk_pool != nullptr) {
+				chunk_pool->parallel_for(n, func);
+				return;
+			}
+
+			for (size_t i = 0; i < n; ++i) {
+				func(i);
+			}
+		};
+
+		char error[256];
+
+		// file data follows the directory, which is written last
+		stream.write(dir_buffer.data(), dir_buffer.size());
+
+		size_t data_offset = dir_buffer.size();
+
+		const size_t batch_size = WRITE_BATCH_FILES * ((chunk_pool != nullptr)? (chunk_pool->size() + 1): 1);
+
+		std::vector<std::vector<char>> file_buffers;
+		std::vector<std::vector<char>> chunk_buffers;
+		std::vector<char> packed_data;
+
+		for (size_t batch_begin = 0; batch_begin < files.size(); batch_begin += batch_size) {
+			const size_t batch_end = std::min(files.size(), batch_begin + batch_size);
+
+			file_buffers.resize(batch_end - batch_begin);
+
+			run_tasks(file_buffers.size(), [&](size_t i) {
+				file_buffers[i].clear();
+				files[batch_begin + i].source(file_buffers[i]);
+			});
+
+			// every chunk of every compressed file in the batch is a separate task
+			std::vector<std::pair<size_t, size_t>> chunk_tasks;
+			std::vector<size_t> first_chunk_task(file_buffers.size() + 1, 0);
+
+			for (size_t i = 0; i < file_buffers.size(); ++i) {
+				first_chunk_task[i] = chunk_tasks.size();
+
+				if (files[batch_begin + i].compression_type == COMPRESSION_TYPE_NULL)
+					continue;
+
+				for (size_t chunk_offset = 0; chunk_offset < file_buffers[i].size(); chunk_offset += HPI_CHUNK_SIZE) {
+					chunk_tasks.emplace_back(i, chunk_offset);
+				}
+			}
+
+			first_chunk_task[file_buffers.size()] = chunk_tasks.size();
+			chunk_buffers.resize(chunk_tasks.size());
+
+			run_tasks(chunk_tasks.size(), [&](size_t k) {
+				const std::vector<char>& file_buffer = file_buffers[chunk_tasks[k].first];
+				const size_t chunk_offset = chunk_tasks[k].second;
+
+				pack_chunk(file_buffer.data() + chunk_offset, std::min<size_t>(HPI_CHUNK_SIZE, file_buffer.size() - chunk_offset), files[batch_begin + chunk_tasks[k].first].compression_type, encode_chunks, chunk_buffers[k]);
+			});
+
+			for (size_t i = 0; i < file_buffers.size(); ++i) {
+				const file_node& file = files[batch_begin + i];
+				const size_t file_size = file_buffers[i].size();
+
+				if (file.compression_type == COMPRESSION_TYPE_NULL) {
+					packed_data.swap(file_buffers[i]);
+				} else {
+					// chunk_sizes table followed by the chunks
+					packed_data.clear();
+
+					for (size_t k = first_chunk_task[i]; k < first_chunk_task[i + 1]; ++k) {
+						const uint32_t packed_chunk_size = chunk_buffers[k].size();
+						packed_data.insert(packed_data.end(), reinterpret_cast<const char*>(&packed_chunk_size), reinterpret_cast<const char*>(&packed_chunk_size + 1));
+					}
+					for (size_t k = first_chunk_task[i]; k < first_chunk_task[i + 1]; ++k) {
+						packed_data.insert(packed_data.end(), chunk_buffers[k].begin(), chunk_buffers[k].end());
+					}
+				}
+
+				if (file_size > std::numeric_limits<uint32_t>::max() || (data_offset + packed_data.size()) > std::numeric_limits<uint32_t>::max()) {
+					snprintf(error, sizeof(error) - 1, "[%s] archive exceeds 4GB after %lu files", __func__, batch_begin + i);
+					throw hpi_exception(error);
+					return false;
+				}
+
+				hpi_file_data file_data;
+				file_data.data_offset = data_offset;
+				file_data.file_size = file_size;
+				file_data.compression_type = file.compression_type;
+
+				std::memcpy(dir_buffer.data() + file_data_offsets[batch_begin + i], &file_data, sizeof(file_data));
+
+				encrypt_buffer(key, data_offset, packed_data.data(), packed_data.size());
+				stream.write(packed_data.data(), packed_data.size());
+
+				data_offset += packed_data.size();
+			}
+		}
+
+		hpi_version archive_version;
+		hpi_header archive_header;
+
+		archive_version.magic = HPI_MAGIC_NUMBER;
+		archive_version.version = HPI_VERSION_NUMBER;
+		archive_header.directory_size = dir_buffer.size();
+		archive_header.header_key = header_key;
+		archive_header.start = dir_start;
+
+		std::memcpy(dir_buffer.data(), &archive_version, sizeof(archive_version));
+		std::memcpy(dir_buffer.data() + sizeof(archive_version), &archive_header, sizeof(archive_header));
+
+		encrypt_buffer(key, dir_start, dir_buffer.data() + dir_start, dir_buffer.size() - dir_start);
+
+		stream.seekp(0);
+		stream.write(dir_buffer.data(), dir_buffer.size());
+
+		if (!stream.flush()) {
+			snprintf(error, sizeof(error) - 1, "[%s] failed to write '%s'", __func__, file_path.c_str());
+			throw hpi_exception(error);
+			return false;
+		}
+
+		return true;
+	}
+}
+
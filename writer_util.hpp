@@ -0,0 +1,80 @@
+#ifndef HAPINESS_WRITER_UTIL_HDR
+#define HAPINESS_WRITER_UTIL_HDR
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace util {
+	class thread_pool;
+
+	// packs files into an HPI archive; the inverse of hpi_archive
+	class hpi_archive_writer {
+	public:
+		// fills <data> with the contents of a file, called once from write()
+		// note: may be called from chunk pool threads, concurrently for different files
+		typedef std::function<void(std::vector<char>& data)> file_source;
+
+	public:
+		hpi_archive_writer();
+		hpi_archive_writer(const hpi_archive_writer&) = delete;
+
+		hpi_archive_writer& operator = (const hpi_archive_writer&) = delete;
+
+		// paths use '/' as separator, missing parent directories are created
+		// note: names are case-insensitive, adding an existing name throws hpi_exception
+		void add_path(std::string_view path);
+		void add_file(std::string_view path, uint8_t compression_type, const file_source& source);
+		void add_file(std::string_view path, uint8_t compression_type, std::vector<char> data);
+
+		// non-zero encrypts everything following the archive header
+		void set_header_key(uint32_t key) { header_key = key; }
+		// encodes the payload of every chunk
+		void set_encode_chunks(bool encode) { encode_chunks = encode; }
+
+		// if set, files are loaded and their chunks compressed in parallel on <pool>
+		void set_chunk_pool(thread_pool* pool) { chunk_pool = pool; }
+
+		size_t get_num_files() const { return files.size(); }
+
+		// returns false if <file_path> can not be created, throws hpi_exception on other errors
+		bool write(const std::string& file_path) const;
+
+	private:
+		struct path_node {
+			std::string name;
+
+			// index into <files>, or -1 for directories
+			uint32_t file_index = -1;
+
+			// children in insertion order, keyed by upper-cased name for duplicate checks
+			std::vector<uint32_t> children;
+			std::map<std::string, uint32_t> child_names;
+		};
+
+		struct file_node {
+			file_source source;
+			uint8_t compression_type = 0;
+		};
+
+		uint32_t add_node(std::string_view path, uint32_t file_index);
+
+		void layout_directory(uint32_t node_index, size_t path_offset, std::vector<char>& dir_buffer, std::vector<size_t>& file_data_offsets) const;
+
+	private:
+		// nodes[0] is the root directory
+		std::vector<path_node> nodes;
+		std::vector<file_node> files;
+
+		thread_pool* chunk_pool = nullptr;
+
+		uint32_t header_key = 0;
+		bool encode_chunks = false;
+	};
+}
+
+#endif
+